@@ -21,7 +21,6 @@ static uint64_t __core_mask__;
 static __thread core_t *__core__;
 
 int core_ring_init(core_t *core);
-int core_ring_count(core_t *core);
 int core_request_va1(int hash, int priority, const char *name,
                      func_va_t exec, va_list ap);
 
@@ -89,14 +88,68 @@ STATIC void *__core_check_health__(void *_arg)
         }
 }
 
+static void core_stat_group(core_t *core)
+{
+        sche_t *sche = core->sche;
+        sche_group_stat_t stat[SCHE_GROUP_MAX];
+
+        for (int i = 0; i < SCHE_GROUP_MAX; i++) {
+                sche_group_stat(sche, i, &stat[i]);
+        }
+
+        DINFO("%s[%d] group %s "
+              "runable:%u/%u/%u/%u "
+              "run:%ju/%ju/%ju/%ju "
+              "run_time:%ju/%ju/%ju/%ju\n",
+              core->name, core->hash,
+              sche->policy == SCHE_POLICY_WFQ ? "wfq" : "strict",
+              sche->runable[0].count, sche->runable[1].count,
+              sche->runable[2].count, sche->runable[3].count,
+              stat[0].run, stat[1].run, stat[2].run, stat[3].run,
+              stat[0].run_time, stat[1].run_time,
+              stat[2].run_time, stat[3].run_time);
+}
+
+static void core_stat_ring(core_t *core)
+{
+        core_ring_stat_t stat;
+
+        core_ring_count(core, &stat);
+
+        DINFO("%s[%d] ring queue:%u overflow:%u spill:%ju full:%ju "
+              "doorbell:%ju/%ju\n",
+              core->name, core->hash, stat.count, stat.overflow,
+              stat.spill, stat.full, stat.post, stat.saved);
+}
+
+static void core_stat_hybrid(core_t *core, uint64_t used)
+{
+        if (!core->hybrid)
+                return;
+
+        DINFO("%s[%d] hybrid spin:%ju%% sleep:%ju%% wake:%ju lat:%ju\n",
+              core->name, core->hash,
+              core->stat_spin * 100 / used,
+              core->stat_sleep * 100 / used,
+              core->stat_wake,
+              core->stat_wake ? core->stat_wake_lat / core->stat_wake : 0);
+
+        core->stat_spin = 0;
+        core->stat_sleep = 0;
+        core->stat_wake = 0;
+        core->stat_wake_lat = 0;
+}
+
 static void IO_FUNC core_stat(core_t *core)
 {
         int sid, taskid, task_wait, task_used, task_runable, ring_count;
-        uint64_t run_time, c_runtime;
+        int req_depth, req_hwm;
+        uint64_t run_time, c_runtime, req_full;
 
         sche_stat(&sid, &taskid, &task_runable, &task_wait, &task_used,
                   &run_time, &c_runtime);
-        ring_count = core_ring_count(core);
+        ring_count = core_ring_count(core, NULL);
+        sche_request_stat(core->sche, &req_depth, &req_hwm, &req_full);
 
         _gettimeofday(&core->stat_t2, NULL);
         uint64_t used = _time_used(&core->stat_t1, &core->stat_t2);
@@ -107,12 +160,22 @@ static void IO_FUNC core_stat(core_t *core)
                       "pps:%jd "
                       "task:%u/%u/%u "
                       "ring:%u "
+                      "wakeup:%ju "
+                      "request:%u/%u/%ju "
+                      "steal:%ju/%ju "
+                      "inline:%ju "
+                      "slice:%ju/%ju "
                       "counter:%ju "
                       "cpu %ju \n",
                       core->name, core->hash,
                       (core->stat_nr2 - core->stat_nr1) * 1000000 / used,
                       task_used, task_wait, task_runable,
                       ring_count,
+                      (core->sche->reply_remote_count - core->stat_wakeup) * 1000000 / used,
+                      req_depth, req_hwm, req_full,
+                      core->sche->steal, core->sche->steal_fail,
+                      (core->sche->c_inline - core->stat_inline) * 1000000 / used,
+                      core->sche->c_overrun, core->sche->c_preempt,
                       core->sche->counter / (core->stat_nr2 - core->stat_nr1),
                       (run_time * 100)/ used);
 #else
@@ -131,24 +194,181 @@ static void IO_FUNC core_stat(core_t *core)
                       "pps:%jd "
                       "task:%lu/%lu/%lu "
                       "task count %lu used %lu c_run_time %lu "
+                      "wakeup:%ju "
+                      "request:%u/%u/%ju "
+                      "steal:%ju/%ju "
+                      "inline:%ju "
+                      "slice:%ju/%ju "
                       "cpu %ju\n",
                       core->name, core->hash,
                       (core->stat_nr2 - core->stat_nr1) * 1000000 / used,
                       avg_task_count, avg_task_runtime, avg_lat,
                       task_used, used,c_runtime, 
+                      (core->sche->reply_remote_count - core->stat_wakeup) * 1000000 / used,
+                      req_depth, req_hwm, req_full,
+                      core->sche->steal, core->sche->steal_fail,
+                      (core->sche->c_inline - core->stat_inline) * 1000000 / used,
+                      core->sche->c_overrun, core->sche->c_preempt,
                       (run_time * 100) / used 
                 );
 #endif
+                core_stat_group(core);
+                core_stat_ring(core);
+                core_stat_hybrid(core, used);
+
                 core->stat_t1 = core->stat_t2;
                 core->stat_nr1 = core->stat_nr2;
+                core->stat_wakeup = core->sche->reply_remote_count;
+                core->stat_inline = core->sche->c_inline;
                 core->sche->counter = 0;
         }
 }
 
+static core_t *__core_steal_pick(core_t *core)
+{
+        core_t *victim;
+        coremask_t *mask = &core->steal_mask;
+
+        // xorshift, _random() reseeds and locks
+        core->steal_seed ^= core->steal_seed << 13;
+        core->steal_seed ^= core->steal_seed >> 17;
+        core->steal_seed ^= core->steal_seed << 5;
+
+        victim = __core_array__[mask->coreid[core->steal_seed % mask->count]];
+        if (victim == core || victim->sche == NULL
+            || !(victim->flag & CORE_FLAG_POLLING))
+                return NULL;
+
+        return victim;
+}
+
+/**
+ * idle polling core takes one migratable task from the busier of two
+ * random polling cores, rounds without a find double the idle rounds
+ * skipped before the next try, up to CORE_STEAL_BACKOFF.
+ */
+static void __core_steal(core_t *core)
+{
+        core_t *a, *b;
+
+        if (core->steal_skip) {
+                core->steal_skip--;
+                return;
+        }
+
+        if (unlikely(core->steal_mask.count == 0)) {
+                coremask_trans(&core->steal_mask, core_mask());
+                core->steal_seed = (uint32_t)get_rdtsc() | 1;
+        }
+
+        a = __core_steal_pick(core);
+        b = __core_steal_pick(core);
+        if (a == NULL || (b && core_load(b->hash) > core_load(a->hash)))
+                a = b;
+
+        if (a && sche_steal(core->sche, a->sche, 1)) {
+                core->steal_backoff = 0;
+                return;
+        }
+
+        core->steal_backoff = core->steal_backoff
+                ? _min(core->steal_backoff * 2, CORE_STEAL_BACKOFF) : 1;
+        core->steal_skip = core->steal_backoff;
+}
+
+/**
+ * poll timeout in ms for the blocking poller (corenet epoll or core_event)
+ */
+int core_poll_tmo(core_t *core)
+{
+        int64_t usec;
+
+        if (!(core->flag & CORE_FLAG_POLLING))
+                return 1000;
+
+        if (likely(!core->armed))
+                return 0;
+
+        usec = timer_idle(core);
+        if (usec < 0 || usec >= 1000 * 1000)
+                return 1000;
+
+        return (usec + 999) / 1000;
+}
+
+static void __core_wakeup(core_t *core, uint64_t begin)
+{
+        uint64_t now, post;
+        sche_t *sche = core->sche;
+
+        sche_disarm(sche);
+        core->armed = 0;
+
+        now = get_rdtsc();
+        core->stat_sleep += _microsec_used(begin, now, sche->hz);
+
+        post = __atomic_load_n(&sche->post_time, __ATOMIC_RELAXED);
+        if (post > begin) {
+                core->stat_wake++;
+                core->stat_wake_lat += _microsec_used(post, now, sche->hz);
+        }
+}
+
+/**
+ * nothing ran for ltgconf.polling_idle usec, let the poller block
+ */
+static void __core_idle(core_t *core, uint64_t counter)
+{
+        int ret;
+        uint64_t now;
+        sche_t *sche = core->sche;
+
+        now = get_rdtsc();
+        if (counter != sche->counter) {
+                if (core->idle_begin) {
+                        core->stat_spin += _microsec_used(core->idle_begin, now, sche->hz);
+                        core->idle_begin = 0;
+                }
+
+                return;
+        }
+
+        if (core->idle_begin == 0) {
+                core->idle_begin = now;
+                return;
+        }
+
+        if (_microsec_used(core->idle_begin, now, sche->hz)
+            < (uint64_t)ltgconf_global.polling_idle) {
+                return;
+        }
+
+        if (timer_idle(core) == 0) {
+                return;
+        }
+
+        core->stat_spin += _microsec_used(core->idle_begin, now, sche->hz);
+        core->idle_begin = 0;
+
+        ret = sche_arm(sche);
+        if (ret)
+                return;
+
+        // core_ring producers check armed after enqueue, see sche_post
+        if (core_ring_count(core, NULL)) {
+                sche_disarm(sche);
+                return;
+        }
+
+        core->armed = 1;
+}
+
 void IO_FUNC core_worker_run(core_t *core)
 {
         struct list_head *pos;
         routine_t *routine;
+        uint64_t counter = core->sche->counter, begin = 0, now_tsc;
+        uint64_t event = core->poll_event;
 
         core->stat_nr2++;
 
@@ -158,6 +378,10 @@ void IO_FUNC core_worker_run(core_t *core)
 
         sche_run(core->sche);
 
+        if (unlikely(core->armed)) {
+                begin = get_rdtsc();
+        }
+
         list_for_each(pos, &core->poller_list) {
                 routine = (void *)pos;
                 routine->func(core, core, routine->ctx);
@@ -165,8 +389,18 @@ void IO_FUNC core_worker_run(core_t *core)
                 //sche_run(core->sche);
         }
 
+        sche_polled(core->sche);
+
+        if (unlikely(core->armed)) {
+                __core_wakeup(core, begin);
+        }
+
         sche_run(core->sche);
 
+        if (counter == core->sche->counter && (core->flag & CORE_FLAG_POLLING)) {
+                __core_steal(core);
+        }
+
         list_for_each(pos, &core->routine_list) {
                 routine = (void *)pos;
                 routine->func(core, core, routine->ctx);
@@ -193,6 +427,20 @@ void IO_FUNC core_worker_run(core_t *core)
         gettime_refresh(core);
         timer_expire(core);
 
+        // one sche_post per target core for all messages of this round
+        core_ring_flush(core);
+
+        if (core->hybrid) {
+                __core_idle(core, counter);
+        }
+
+        // no event polled and no task run, the whole round was idle
+        now_tsc = get_rdtsc();
+        if (counter == core->sche->counter && event == core->poll_event) {
+                core->idle_tsc += now_tsc - core->loop_tsc;
+        }
+        core->loop_tsc = now_tsc;
+
 #if ENABLE_ANALYSIS
         analysis_merge(core);
 #else
@@ -240,8 +488,13 @@ static int __core_worker_init(core_t *core)
                 core_tls_set(VARIABLE_HUGEPAGE, hugepage);
         }
 
+        // rdma completions are only polled, no fd to block on
+        core->hybrid = (core->flag & CORE_FLAG_POLLING) && ltgconf_global.polling_idle
+                && !ltgconf_global.rdma;
+
         core->interrupt_eventfd = -1;
-        int *interrupt = !(core->flag & CORE_FLAG_POLLING) ? &core->interrupt_eventfd : NULL;
+        int *interrupt = (!(core->flag & CORE_FLAG_POLLING) || core->hybrid)
+                ? &core->interrupt_eventfd : NULL;
 
         snprintf(name, sizeof(name), core->name);
         ret = sche_create(interrupt, name, &core->sche_idx, &core->sche, NULL);
@@ -251,9 +504,19 @@ static int __core_worker_init(core_t *core)
 
         core_tls_set(VARIABLE_SCHEDULE, core->sche);
 
+        if (core->hybrid) {
+                sche_hybrid_set(core->sche);
+        }
+
+        if (core_usedby(ltgconf_global.sche_wfq_mask, core->hash)) {
+                ret = sche_policy_set(core->sche, SCHE_POLICY_WFQ, NULL);
+                if (unlikely(ret))
+                        GOTO(err_ret, ret);
+        }
+
         DINFO("%s[%u] sche[%d] inited\n", core->name, core->hash, core->sche_idx);
 
-        if (!interrupt) {
+        if (core->flag & CORE_FLAG_POLLING) {
                 ret = timer_init(1);
                 if (unlikely(ret))
                         GOTO(err_ret, ret);
@@ -332,12 +595,7 @@ static int __core_create(core_t **_core, const char *name, int hash, int flag)
 {
         int ret, lock;
         core_t *core;
-
-        ret = ltg_malloc((void **)&core, sizeof(*core));
-        if (unlikely(ret))
-                GOTO(err_ret, ret);
-
-        memset(core, 0x0, sizeof(*core));
+        coreinfo_t *coreinfo = NULL;
 
 #if POLLING_LOCK
         lock = ltgconf_global.daemon && (flag & CORE_FLAG_POLLING);
@@ -346,13 +604,20 @@ static int __core_create(core_t **_core, const char *name, int hash, int flag)
 #endif
 
         if (lock) {
-                ret = cpuset_lock(hash, &core->main_core);
+                ret = cpuset_lock(hash, &coreinfo);
                 if (unlikely(ret))
                         GOTO(err_ret, ret);
-        } else {
-                core->main_core = NULL;
         }
 
+        // on the node of the cpu that will poll it
+        ret = ltg_malloc_node((void **)&core, sizeof(*core),
+                              coreinfo ? coreinfo->node_id : -1);
+        if (unlikely(ret))
+                GOTO(err_ret, ret);
+
+        memset(core, 0x0, sizeof(*core));
+        core->main_core = coreinfo;
+
         strcpy(core->name, name);
         core->sche_idx = -1;
         core->hash = hash;
@@ -473,6 +738,10 @@ int core_init(uint64_t mask, int flag)
                 GOTO(err_ret, ret);
 #endif
 
+        ret = core_load_init();
+        if (unlikely(ret))
+                GOTO(err_ret, ret);
+
         return 0;
 err_ret:
         return ret;
@@ -484,6 +753,10 @@ int core_attach(int hash, const sockid_t *sockid, const char *name,
         int ret;
         core_t *core;
 
+        if (hash == CORE_ANY) {
+                hash = core_balance(core_mask());
+        }
+
         DBUG("attach hash %d fd %d name %s\n", hash, sockid->sd, name);
 
         core = core_get(hash);
@@ -523,10 +796,18 @@ static int __core_dump_memory(void *_core, void *_arg)
         core_t *core = _core;
         uint64_t *memory = _arg;
 
+        int page;
+        uint64_t used;
         sche_t *sche = core->sche;
+
         *memory += sizeof(core_t) +
                    sizeof(sche_t) +
-                   (sizeof(taskctx_t) + DEFAULT_STACK_SIZE) * sche->size;
+                   sizeof(taskctx_t) * sche->size;
+
+        for (int i = 0; i < SCHE_STACK_MAX; i++) {
+                sche_stack_stat(sche, i, &page, &used);
+                *memory += (uint64_t)page * STACK_PAGE_SIZE;
+        }
 
         return 0;
 }
@@ -546,6 +827,193 @@ int core_dump_memory(uint64_t *memory)
 }
 
 
+static int __core_dump_stack(void *_core, void *_arg)
+{
+        core_t *core = _core;
+
+        (void) _arg;
+
+        sche_stack_prof_dump(core->sche);
+
+        return 0;
+}
+
+/**
+ * ltgconf.stack_profile打开时，按task函数输出stack深度分布
+ */
+void core_dump_stack()
+{
+        core_iterator(__core_dump_stack, NULL);
+}
+
+static int __core_dump_numa(void *_core, void *_arg)
+{
+        int node, local = 0, remote = 0, reply_local = 0, reply_remote = 0;
+        core_t *core = _core;
+        core_ring_t *ring = core->ring;
+        sche_t *sche = core->sche;
+        void *corenet = core->tls[VARIABLE_CORENET_TCP];
+        void *maping = core->tls[VARIABLE_MAPING];
+
+        (void) _arg;
+
+        node = core->main_core ? core->main_core->node_id : -1;
+
+        for (int i = 0; i < CORE_MAX; i++) {
+                if (ring->ringbuf[i] == NULL)
+                        continue;
+
+                if (ltg_mem_node(ring->ringbuf[i]) == node) {
+                        local++;
+                } else {
+                        remote++;
+                        DWARN("%s[%d] ring from core[%d] on node %d\n",
+                              core->name, core->hash, i,
+                              ltg_mem_node(ring->ringbuf[i]));
+                }
+        }
+
+        for (int i = 0; i < sche->reply_ring_count; i++) {
+                if (ltg_mem_node(sche->reply_ring_array[i]) == node) {
+                        reply_local++;
+                } else {
+                        reply_remote++;
+                }
+        }
+
+        DINFO("%s[%d] node %d core %d sche %d request %d corenet %d maping %d "
+              "ring %d/%d reply %d/%d\n", core->name, core->hash, node,
+              ltg_mem_node(core), ltg_mem_node(sche),
+              ltg_mem_node(sche->request_queue.queue),
+              corenet ? ltg_mem_node(corenet) : -1,
+              maping ? ltg_mem_node(maping) : -1,
+              local, remote, reply_local, reply_remote);
+
+        return 0;
+}
+
+/**
+ * 输出每个core的numa node和其结构所在的node, ring/reply为本地/远端个数
+ * ring和reply ring在第一次请求时才创建，有流量之后再调用
+ */
+void core_dump_numa()
+{
+        core_iterator(__core_dump_numa, NULL);
+}
+
+typedef struct {
+        int type;
+        int count;
+        sche_prof_t *snap;
+        sche_prof_t *merged;
+} core_prof_t;
+
+static int __core_dump_prof(void *_core, void *_arg)
+{
+        int i, j, k, count;
+        core_t *core = _core;
+        core_prof_t *ctx = _arg;
+        sche_prof_t *src, *dst;
+
+        count = sche_prof_snapshot(core->sche, ctx->type, ctx->snap, SCHE_PROF_MAX);
+        for (i = 0; i < count; i++) {
+                src = &ctx->snap[i];
+
+                for (j = 0; j < ctx->count; j++) {
+                        if (strcmp(ctx->merged[j].name, src->name) == 0)
+                                break;
+                }
+
+                dst = &ctx->merged[j];
+                if (j == ctx->count) {
+                        if (ctx->count == SCHE_PROF_MAX)
+                                continue;
+
+                        memcpy(dst, src, sizeof(*dst));
+                        ctx->count++;
+                        continue;
+                }
+
+                dst->count += src->count;
+                dst->sum += src->sum;
+                dst->max = src->max > dst->max ? src->max : dst->max;
+                for (k = 0; k < SCHE_PROF_HIST; k++) {
+                        dst->hist[k] += src->hist[k];
+                }
+        }
+
+        return 0;
+}
+
+static uint64_t __core_prof_percent(const sche_prof_t *prof, int percent)
+{
+        int i;
+        uint64_t sum = 0, target;
+
+        target = (prof->count * percent + 99) / 100;
+        for (i = 0; i < SCHE_PROF_HIST - 1; i++) {
+                sum += prof->hist[i];
+                if (sum >= target)
+                        return (uint64_t)256 << i;
+        }
+
+        return prof->max;
+}
+
+/**
+ * ltgconf.task_profile打开时，合并所有core的快照，按name输出
+ * run(每次切入的运行时间)/cpu(任务总运行时间)/wait(yield到恢复)分布
+ * slice(超过ltgconf.task_slice的切入)
+ */
+void core_dump_prof()
+{
+        int ret, i, j, len;
+        char hist[MAX_INFO_LEN];
+        core_prof_t ctx;
+        sche_prof_t *prof;
+        static const char *type_name[SCHE_PROF_TYPE] = {"run", "cpu", "wait", "slice"};
+
+        ret = ltg_malloc((void **)&ctx.snap, sizeof(sche_prof_t) * SCHE_PROF_MAX * 2);
+        if (unlikely(ret))
+                return;
+
+        ctx.merged = ctx.snap + SCHE_PROF_MAX;
+
+        for (ctx.type = 0; ctx.type < SCHE_PROF_TYPE; ctx.type++) {
+                ctx.count = 0;
+                core_iterator(__core_dump_prof, &ctx);
+
+                for (i = 0; i < ctx.count; i++) {
+                        prof = &ctx.merged[i];
+                        if (prof->count == 0)
+                                continue;
+
+                        len = 0;
+                        hist[0] = '\0';
+                        for (j = 0; j < SCHE_PROF_HIST; j++) {
+                                if (prof->hist[j] == 0)
+                                        continue;
+
+                                len += snprintf(hist + len, MAX_INFO_LEN - len, "%s%s%juns:%ju",
+                                                len ? " " : "",
+                                                j == SCHE_PROF_HIST - 1 ? ">" : "",
+                                                (uint64_t)256 << (j == SCHE_PROF_HIST - 1 ? j - 1 : j),
+                                                prof->hist[j]);
+                        }
+
+                        DINFO("prof %s %s count %ju total %juus avg %juns p50 %juns "
+                              "p99 %juns max %juns hist %s\n",
+                              type_name[ctx.type], prof->name, prof->count,
+                              prof->sum / 1000, prof->sum / prof->count,
+                              __core_prof_percent(prof, 50),
+                              __core_prof_percent(prof, 99),
+                              prof->max, hist);
+                }
+        }
+
+        ltg_free((void **)&ctx.snap);
+}
+
 static int __core_register(struct list_head *list, const char *name, func2_t func, void *ctx)
 {
         int ret;
@@ -680,21 +1148,36 @@ err_ret:
         return ret;
 }
 
-int core_init_modules(const char *name, func_va_t exec, ...)
+typedef struct {
+        func_va_t exec;
+        va_list ap;
+} core_init_t;
+
+static int __core_init_map(void *arg, void *result)
 {
-        int ret;
+        core_init_t *ctx = arg;
         va_list ap;
 
-        va_start(ap, exec);
+        (void) result;
 
-        for (int i = 0; i < CORE_MAX; i++) {
-                if (!core_used(i))
-                        continue;
+        // every core reads the caller's arguments through its own copy
+        va_copy(ap, ctx->ap);
 
-                ret = core_request_va1(i, -1, name, exec, ap);
-                if (ret)
-                        GOTO(err_ret, ret);
-        }
+        return ctx->exec(ap);
+}
+
+int core_init_modules(const char *name, func_va_t exec, ...)
+{
+        int ret;
+        core_init_t ctx;
+
+        ctx.exec = exec;
+        va_start(ctx.ap, exec);
+
+        ret = core_broadcast(name, core_mask(), __core_init_map, &ctx, 0, NULL, NULL);
+        va_end(ctx.ap);
+        if (ret)
+                GOTO(err_ret, ret);
 
         return 0;
 err_ret:
@@ -727,20 +1210,17 @@ void core_occupy(const char *name, uint64_t coremask)
 int core_init_modules1(const char *name, uint64_t coremask, func_va_t exec, ...)
 {
         int ret;
-        va_list ap;
-
-        va_start(ap, exec);
+        core_init_t ctx;
 
-        for (int i = 0; i < CORE_MAX; i++) {
-                if (!core_usedby(coremask, i))
-                        continue;
+        LTG_ASSERT((coremask & core_mask()) == coremask);
 
-                LTG_ASSERT(core_used(i));
+        ctx.exec = exec;
+        va_start(ctx.ap, exec);
 
-                ret = core_request_va1(i, -1, name, exec, ap);
-                if (ret)
-                        GOTO(err_ret, ret);
-        }
+        ret = core_broadcast(name, coremask, __core_init_map, &ctx, 0, NULL, NULL);
+        va_end(ctx.ap);
+        if (ret)
+                GOTO(err_ret, ret);
 
         return 0;
 err_ret:
@@ -807,7 +1287,7 @@ int core_request_va1(int hash, int priority, const char *name, func_va_t exec, v
                 ctx.type = REQUEST_TASK;
                 ctx.task = task;
 
-                ret = sche_request(sche, priority, __core_request__, &ctx, name);
+                ret = sche_request_wait(sche, priority, __core_request__, &ctx, name);
                 if (unlikely(ret))
                         GOTO(err_ret, ret);
 
@@ -821,7 +1301,7 @@ int core_request_va1(int hash, int priority, const char *name, func_va_t exec, v
                 if (unlikely(ret))
                         UNIMPLEMENTED(__DUMP__);
 
-                ret = sche_request(sche, priority, __core_request__, &ctx, name);
+                ret = sche_request_wait(sche, priority, __core_request__, &ctx, name);
                 if (unlikely(ret))
                         GOTO(err_ret, ret);
 
@@ -858,6 +1338,184 @@ err_ret:
         return ret;
 }
 
+typedef struct {
+        core_map_t map;
+        void *arg;
+        char *result;
+        int size;
+        int count;              // cores still running map, +1 while queueing
+        int type;
+        task_t task;
+        sem_t sem;
+        int retval[CORE_MAX];
+} broadcast_t;
+
+typedef struct {
+        broadcast_t *bc;
+        int idx;
+} broadcast_ctx_t;
+
+static void __core_broadcast_done(broadcast_t *bc)
+{
+        if (__atomic_sub_fetch(&bc->count, 1, __ATOMIC_ACQ_REL))
+                return;
+
+        // the caller may return right after, bc is not touched any more
+        if (bc->type == REQUEST_SEM) {
+                sem_post(&bc->sem);
+        } else {
+                sche_task_post(&bc->task, 0, NULL);
+        }
+}
+
+static void __core_broadcast__(void *_ctx)
+{
+        broadcast_ctx_t *ctx = _ctx;
+        broadcast_t *bc = ctx->bc;
+
+        bc->retval[ctx->idx] = bc->map(bc->arg, bc->result
+                                       ? bc->result + bc->size * ctx->idx : NULL);
+
+        __core_broadcast_done(bc);
+}
+
+static int __core_broadcast_wait(broadcast_t *bc, const char *name)
+{
+        int ret;
+        struct timespec ts;
+
+        if (bc->type == REQUEST_TASK) {
+                ret = sche_yield1(name, NULL, NULL, NULL, -1);
+                if (unlikely(ret))
+                        GOTO(err_ret, ret);
+
+                return 0;
+        }
+
+        while (1) {
+                if (core_self() == NULL) {
+                        ret = _sem_wait(&bc->sem);
+                        if (unlikely(ret))
+                                GOTO(err_ret, ret);
+
+                        break;
+                }
+
+                // the caller core may be one of the targets
+                clock_gettime(CLOCK_REALTIME, &ts);
+                ts.tv_nsec += 1000 * 10;
+                ret = _sem_timedwait(&bc->sem, &ts);
+                if (unlikely(ret)) {
+                        if (ret == ETIMEDOUT) {
+                                core_worker_run(core_self());
+                                continue;
+                        } else
+                                GOTO(err_ret, ret);
+                }
+
+                break;
+        }
+
+        return 0;
+err_ret:
+        return ret;
+}
+
+int core_broadcast(const char *name, uint64_t coremask, core_map_t map, void *arg,
+                   int size, core_reduce_t reduce, void *acc)
+{
+        int ret, i;
+        broadcast_t bc;
+        broadcast_ctx_t ctx[CORE_MAX];
+        core_t *core;
+
+        bc.map = map;
+        bc.arg = arg;
+        bc.size = size;
+        bc.result = NULL;
+        bc.count = 1;
+
+        if (size) {
+                ret = ltg_malloc((void **)&bc.result, size * CORE_MAX);
+                if (unlikely(ret))
+                        GOTO(err_ret, ret);
+
+                memset(bc.result, 0x0, size * CORE_MAX);
+        }
+
+        if (sche_running()) {
+                ret = sche_task_get1(sche_self(), &bc.task);
+                if (unlikely(ret)) {
+                        DWARN("task busy\n");
+                        UNIMPLEMENTED(__DUMP__);
+                }
+
+                bc.type = REQUEST_TASK;
+        } else {
+                bc.type = REQUEST_SEM;
+                ret = sem_init(&bc.sem, 0, 0);
+                if (unlikely(ret))
+                        UNIMPLEMENTED(__DUMP__);
+        }
+
+        for (i = 0; i < CORE_MAX; i++) {
+                bc.retval[i] = 0;
+                if (!core_usedby(coremask, i))
+                        continue;
+
+                core = core_get(i);
+                if (unlikely(core->sche == NULL)) {
+                        bc.retval[i] = ENOSYS;
+                        continue;
+                }
+
+                ctx[i].bc = &bc;
+                ctx[i].idx = i;
+                __atomic_add_fetch(&bc.count, 1, __ATOMIC_RELAXED);
+
+                ret = sche_request_wait(core->sche, -1, __core_broadcast__, &ctx[i], name);
+                if (unlikely(ret)) {
+                        bc.retval[i] = ret;
+                        __atomic_sub_fetch(&bc.count, 1, __ATOMIC_RELAXED);
+                }
+        }
+
+        // drop the guard, the last of us and the cores wakes the caller
+        if (__atomic_sub_fetch(&bc.count, 1, __ATOMIC_ACQ_REL)) {
+                ret = __core_broadcast_wait(&bc, name);
+                if (unlikely(ret))
+                        UNIMPLEMENTED(__DUMP__);
+        } else if (bc.type == REQUEST_TASK) {
+                sche_task_reset();
+        }
+
+        for (i = 0; i < CORE_MAX; i++) {
+                if (!core_usedby(coremask, i))
+                        continue;
+
+                if (unlikely(bc.retval[i])) {
+                        ret = bc.retval[i];
+                        GOTO(err_free, ret);
+                }
+
+                if (reduce) {
+                        ret = reduce(acc, bc.result ? bc.result + size * i : NULL, i);
+                        if (unlikely(ret))
+                                GOTO(err_free, ret);
+                }
+        }
+
+        if (bc.result)
+                ltg_free((void **)&bc.result);
+
+        return 0;
+err_free:
+        if (bc.result)
+                ltg_free((void **)&bc.result);
+err_ret:
+        return ret;
+}
+
 int core_request(int coreid, int group, const char *name, func_va_t exec, ...)
 {
         va_list ap;
@@ -19,13 +19,19 @@ extern int ltg_nofile_max;
 
 static void IO_FUNC __core_event_poller(void *_core, void *var, void *_corenet)
 {
-        int ret, count;
+        int ret, count, tmo;
         struct pollfd pfd[1];
         core_t *core = _core;
 
         (void) var;
         (void) _corenet;
-        
+
+        tmo = core_poll_tmo(core);
+        if (tmo == 0) {
+                // spinning
+                return;
+        }
+
         LTG_ASSERT(core->interrupt_eventfd != -1);
 
         pfd[0].fd = core->interrupt_eventfd;
@@ -34,7 +40,7 @@ static void IO_FUNC __core_event_poller(void *_core, void *var, void *_corenet)
         count = 1;
 
         while (1) {
-                ret = poll(pfd, count, 1000);
+                ret = poll(pfd, count, tmo);
                 if (ret < 0)  {
                         ret = errno;
                         if (ret == EINTR) {
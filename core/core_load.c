@@ -0,0 +1,183 @@
+#include <limits.h>
+#include <time.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+
+#define DBG_SUBSYS S_LTG_CORE
+
+#include "ltg_net.h"
+#include "ltg_utils.h"
+#include "ltg_rpc.h"
+#include "ltg_core.h"
+
+/**
+ * per core load estimate, sampled by the owner every CORE_LOAD_INTERVAL
+ * and read lock free by core_balance from any thread.
+ *
+ * score = busy permille + queued work + latency, smoothed 1/8 per sample.
+ * busy is the share of poll loops that polled an event or ran a task,
+ * see core_worker_run.
+ */
+
+#define CORE_LOAD_INTERVAL 1000         // usec between samples
+#define CORE_LOAD_QUEUE 10              // score per runable task or ring message
+#define CORE_LOAD_LATENCY 100           // usec of rpc latency per score point
+#define CORE_LOAD_PLACE 50              // score per placement since the last sample
+
+typedef struct {
+        uint64_t last;          // rdtsc of the last sample
+        uint64_t idle_tsc;      // core->idle_tsc at the last sample
+        uint32_t util;          // busy permille
+        uint32_t queue;         // runable tasks, requests and ring backlog
+        uint32_t latency;       // usec, core_latency_get
+        uint32_t score;
+        uint32_t placed;        // picked by core_balance since the last sample
+} core_load_t;
+
+static void __core_load_sample(core_t *core, core_load_t *load, uint64_t now)
+{
+        int i, depth, hwm;
+        uint64_t full, used, idle, sample;
+        sche_t *sche = core->sche;
+
+        used = now - load->last;
+        idle = core->idle_tsc - load->idle_tsc;
+        load->util = idle >= used ? 0 : (used - idle) * 1000 / used;
+
+        sche_request_stat(sche, &depth, &hwm, &full);
+        load->queue = depth + core_ring_count(core, NULL);
+        for (i = 0; i < SCHE_GROUP_MAX; i++) {
+                load->queue += sche->runable[i].count;
+        }
+
+        load->latency = core_latency_get();
+
+        sample = load->util + (uint64_t)load->queue * CORE_LOAD_QUEUE
+                + load->latency / CORE_LOAD_LATENCY;
+        if (sample > UINT32_MAX)
+                sample = UINT32_MAX;
+
+        __atomic_store_n(&load->score, (load->score * 7 + sample) / 8,
+                         __ATOMIC_RELAXED);
+        __atomic_store_n(&load->placed, 0, __ATOMIC_RELAXED);
+
+        load->last = now;
+        load->idle_tsc = core->idle_tsc;
+}
+
+static void __core_load_routine(void *_core, void *var, void *arg)
+{
+        uint64_t now;
+        core_t *core = _core;
+        core_load_t *load = arg;
+
+        (void) var;
+
+        now = get_rdtsc();
+        if (likely(_microsec_used(load->last, now, core->sche->hz)
+                   < CORE_LOAD_INTERVAL)) {
+                return;
+        }
+
+        __core_load_sample(core, load, now);
+}
+
+static core_load_t *__core_load(int hash)
+{
+        core_t *core = core_get(hash);
+
+        return __atomic_load_n((core_load_t **)&core->tls[VARIABLE_LOADBALANCE],
+                               __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @return load score of core hash, 0 before its first sample
+ */
+uint32_t core_load(int hash)
+{
+        core_load_t *load = __core_load(hash);
+
+        if (unlikely(load == NULL))
+                return 0;
+
+        return __atomic_load_n(&load->score, __ATOMIC_RELAXED)
+                + __atomic_load_n(&load->placed, __ATOMIC_RELAXED) * CORE_LOAD_PLACE;
+}
+
+/**
+ * @return the least loaded core of mask, for CORE_ANY placement
+ */
+int core_balance(uint64_t mask)
+{
+        int i, hash = -1;
+        uint32_t score, min = UINT32_MAX;
+        coremask_t coremask;
+        core_load_t *load;
+
+        coremask_trans(&coremask, mask & core_mask());
+        LTG_ASSERT(coremask.count);
+
+        for (i = 0; i < coremask.count; i++) {
+                score = core_load(coremask.coreid[i]);
+                if (score < min) {
+                        min = score;
+                        hash = coremask.coreid[i];
+                }
+        }
+
+        // the next pick sees this one before the owner samples again
+        load = __core_load(hash);
+        if (load) {
+                __atomic_add_fetch(&load->placed, 1, __ATOMIC_RELAXED);
+        }
+
+        return hash;
+}
+
+static int __core_load_init(va_list ap)
+{
+        int ret;
+        core_t *core = core_self();
+        core_load_t *load;
+
+        va_end(ap);
+
+        ret = slab_static_alloc1((void **)&load, sizeof(*load));
+        if (unlikely(ret))
+                GOTO(err_ret, ret);
+
+        memset(load, 0x0, sizeof(*load));
+        load->last = get_rdtsc();
+        load->idle_tsc = core->idle_tsc;
+
+        ret = core_register_routine("core_load", __core_load_routine, load);
+        if (unlikely(ret))
+                GOTO(err_free, ret);
+
+        __atomic_store_n((core_load_t **)&core->tls[VARIABLE_LOADBALANCE], load,
+                         __ATOMIC_RELEASE);
+
+        DINFO("%s[%u] load inited\n", core->name, core->hash);
+
+        return 0;
+err_free:
+        slab_static_free1((void **)&load);
+err_ret:
+        return ret;
+}
+
+int core_load_init()
+{
+        int ret;
+
+        ret = core_init_modules("core_load", __core_load_init, NULL);
+        if (unlikely(ret))
+                GOTO(err_ret, ret);
+
+        DINFO("core global load inited\n");
+
+        return 0;
+err_ret:
+        return ret;
+}
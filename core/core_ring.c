@@ -18,9 +18,11 @@
 
 #define OP_REQUEST 1
 #define OP_REPLY 2
+#define OP_CALL 3       // core_call, run inline by the poller
 
 #define RING_SIZE (1<<12)
 #define RING_ARRAY_SIZE 128
+#define RING_OVERFLOW_MAX RING_SIZE     // core_ring_wait sleeps above it
 
 int core_ring_init(core_t *core)
 {
@@ -36,12 +38,36 @@ int core_ring_init(core_t *core)
         if (ret)
                 UNIMPLEMENTED(__DUMP__);
 
+        ret = slab_static_alloc1((void **)&ring->overflow,
+                                 sizeof(*ring->overflow) * CORE_MAX);
+        if (ret)
+                UNIMPLEMENTED(__DUMP__);
+
+        ret = slab_static_alloc1((void **)&ring->doorbell,
+                                 sizeof(*ring->doorbell) * CORE_MAX);
+        if (ret)
+                UNIMPLEMENTED(__DUMP__);
+
+        ret = slab_static_alloc1((void **)&ring->doorbell_list,
+                                 sizeof(*ring->doorbell_list) * CORE_MAX);
+        if (ret)
+                UNIMPLEMENTED(__DUMP__);
+
         INIT_LIST_HEAD(&ring->list);
         
         for (int i = 0; i < CORE_MAX; i++) {
                 ring->ringbuf[i] = NULL;
+                count_list_init(&ring->overflow[i]);
+                ring->doorbell[i] = 0;
         }
 
+        ring->overflow_count = 0;
+        ring->doorbell_count = 0;
+        ring->spill = 0;
+        ring->full = 0;
+        ring->post = 0;
+        ring->saved = 0;
+
         core->ring = ring;
         
         return 0;
@@ -51,22 +77,30 @@ err_ret:
 
 static inline void __core_ring_poller_run(void **array, int count)
 {
+        int batch_count = 0;
         ring_ctx_t *ring_ctx = NULL;
-        
+        sche_batch_t batch[RING_ARRAY_SIZE];
+
         for (int i = 0; i < count; i++) {
                 ring_ctx = array[i];
                         
                 if (ring_ctx->type == OP_REPLY) {
                         ring_ctx->reply_func(ring_ctx->reply_ctx);
+                } else if (ring_ctx->type == OP_CALL) {
+                        sche_task_inline("core_call", ring_ctx->task_run, ring_ctx);
                 } else if (ring_ctx->type == OP_REQUEST) {
-                        sche_task_new("ring", ring_ctx->task_run,
-                                      (void *)ring_ctx, ring_ctx->group);
-
+                        batch[batch_count].func = ring_ctx->task_run;
+                        batch[batch_count].arg = ring_ctx;
+                        batch[batch_count].group = ring_ctx->group;
+                        batch_count++;
                 } else {
                         DWARN("%p\n", ring_ctx);
                         UNIMPLEMENTED(__DUMP__);
                 }
         }
+
+        if (batch_count)
+                sche_task_new_batch("ring", batch, batch_count);
 }
 
 static inline void __core_ring_poller__(struct ringbuf *ringbuf)
@@ -81,6 +115,7 @@ static inline void __core_ring_poller__(struct ringbuf *ringbuf)
                         break;
 
                 DBUG("count %u\n", count);
+                TRACE(TRACE_RING_DEQ, 0, count, NULL);
 
                 __core_ring_poller_run(array, count);
         }
@@ -107,7 +142,11 @@ inline void core_ring_poller(void *_core, void *var, void *arg)
         }
 }
 
-int core_ring_count(core_t *core)
+/**
+ * @return inbound messages queued plus outbound ones still in overflow,
+ * the core must not block while it is not 0
+ */
+int core_ring_count(core_t *core, core_ring_stat_t *stat)
 {
         int count = 0;
         core_ring_t *ring = core->ring;
@@ -118,13 +157,120 @@ int core_ring_count(core_t *core)
                 }
         }
 
-        return count;
+        if (stat) {
+                stat->count = count;
+                stat->overflow = ring->overflow_count;
+                stat->spill = ring->spill;
+                stat->full = ring->full;
+                stat->post = ring->post;
+                stat->saved = ring->saved;
+        }
+
+        return count + ring->overflow_count;
 }
 
-static void __core_ring_new(core_ring_t *ring, int idx)
+/*
+ * every ring has one producer, requests and replies from this core to
+ * coreid share rcore->ring->ringbuf[core->hash], so one overflow list and
+ * one doorbell per target keep both in order.
+ */
+static inline void __core_ring_doorbell(core_ring_t *ring, int coreid)
+{
+        if (likely(!(ltgconf_global.polling_timeout || ltgconf_global.polling_idle)))
+                return;
+
+        if (ring->doorbell[coreid]) {
+                ring->saved++;
+                return;
+        }
+
+        ring->doorbell[coreid] = 1;
+        ring->doorbell_list[ring->doorbell_count++] = coreid;
+}
+
+static void IO_FUNC __core_ring_enqueue(core_t *core, int coreid,
+                                        struct ringbuf *ringbuf, ring_ctx_t *ctx)
 {
         int ret;
+        core_ring_t *ring = core->ring;
+        count_list_t *overflow = &ring->overflow[coreid];
+
+        TRACE(TRACE_RING_ENQ, coreid, 0, NULL);
+
+        if (likely(overflow->count == 0)) {
+                ret = libringbuf_sp_enqueue(ringbuf, (void *)ctx);
+                if (likely(ret != -ENOBUFS)) {
+                        __core_ring_doorbell(ring, coreid);
+                        return;
+                }
+        }
+
+        // ring full, keep the order behind the spilled ones
+        count_list_add_tail(&ctx->hook, overflow);
+        ring->overflow_count++;
+        ring->spill++;
+}
+
+static void __core_ring_overflow(core_t *core, int coreid)
+{
+        int ret, moved = 0;
+        core_ring_t *ring = core->ring;
+        count_list_t *overflow = &ring->overflow[coreid];
+        struct ringbuf *ringbuf = core_get(coreid)->ring->ringbuf[core->hash];
+        ring_ctx_t *ctx;
+
+        while (overflow->count) {
+                ctx = list_entry(overflow->list.next, ring_ctx_t, hook);
+                ret = libringbuf_sp_enqueue(ringbuf, (void *)ctx);
+                if (ret == -ENOBUFS)
+                        break;
+
+                count_list_del(&ctx->hook, overflow);
+                ring->overflow_count--;
+                moved++;
+        }
+
+        if (moved) {
+                __core_ring_doorbell(ring, coreid);
+        }
+}
+
+/**
+ * end of each core_worker_run round, move overflow into the rings and
+ * ring each target once
+ */
+void IO_FUNC core_ring_flush(core_t *core)
+{
+        int coreid;
+        core_ring_t *ring = core->ring;
+
+        if (unlikely(ring->overflow_count)) {
+                for (int i = 0; i < CORE_MAX; i++) {
+                        if (ring->overflow[i].count) {
+                                __core_ring_overflow(core, i);
+                        }
+                }
+        }
+
+        for (int i = 0; i < ring->doorbell_count; i++) {
+                coreid = ring->doorbell_list[i];
+                ring->doorbell[coreid] = 0;
+                ring->post++;
+                sche_post(core_get(coreid)->sche);
+        }
+
+        ring->doorbell_count = 0;
+}
+
+/**
+ * inbound ring of core, placed on the node of its consumer
+ */
+static void __core_ring_new(core_t *core, int idx)
+{
+        int ret, node;
         ringlist_t *ringlist;
+        core_ring_t *ring = core->ring;
+        struct ringbuf *ringbuf;
 
         if (ring->ringbuf[idx]) {
                 return;
@@ -134,9 +280,23 @@ static void __core_ring_new(core_ring_t *ring, int idx)
         if (ret)
                 UNIMPLEMENTED(__DUMP__);
 
-        ring->ringbuf[idx] = libringbuf_create((1<<12),
-                                               RING_F_SP_ENQ
-                                               | RING_F_SC_DEQ);
+        node = core->main_core ? core->main_core->node_id : -1;
+        ret = ltg_malloc_node((void **)&ringbuf, libringbuf_get_memsize(RING_SIZE),
+                              node);
+        if (ret)
+                UNIMPLEMENTED(__DUMP__);
+
+        // created lazily, core_dump_numa only sees the rings made so far
+        if (node != -1 && ltg_mem_node(ringbuf) != node) {
+                DWARN("%s[%d] ring from core[%d] on node %d, want %d\n",
+                      core->name, core->hash, idx, ltg_mem_node(ringbuf), node);
+        }
+
+        ret = libringbuf_init(ringbuf, RING_SIZE, RING_F_SP_ENQ | RING_F_SC_DEQ);
+        if (ret)
+                UNIMPLEMENTED(__DUMP__);
+
+        ring->ringbuf[idx] = ringbuf;
 
         ringlist->ringbuf = ring->ringbuf[idx];
         list_add_tail(&ringlist->hook, &ring->list);
@@ -148,7 +308,7 @@ static int __core_ring_connect__(va_list ap)
         core_t *core = core_self();
         
         if (core->ring->ringbuf[coreid] == NULL) {
-                __core_ring_new(core->ring, coreid);
+                __core_ring_new(core, coreid);
         }
 
         return 0;
@@ -168,7 +328,7 @@ void __core_ring_connect(core_t *rcore, core_t *lcore,
         if (unlikely(lcore->ring->ringbuf[rcore->hash] == NULL)) {
                 DINFO("%s[%d] connect to %s[%d]\n", lcore->name, lcore->hash,
                       rcore->name, rcore->hash);
-                __core_ring_new(lcore->ring, rcore->hash);
+                __core_ring_new(lcore, rcore->hash);
         }
 
         *request = rcore->ring->ringbuf[lcore->hash];
@@ -183,12 +343,8 @@ inline static void __core_request_run__(void *_ctx)
         ring_ctx->request_func(ring_ctx->request_ctx);
         ring_ctx->type = OP_REPLY;
 
-        libringbuf_sp_enqueue(ring_ctx->reply, (void *)ring_ctx);
-
-        if (unlikely(ltgconf_global.polling_timeout)) {
-                core_t *rcore = core_get(reply_coreid);
-                sche_post(rcore->sche);
-        }
+        // never blocks, the waiter is already parked on it
+        __core_ring_enqueue(core_self(), reply_coreid, ring_ctx->reply, ring_ctx);
 }
 
 inline static void __core_ring_queue(int coreid, ring_ctx_t *ctx,
@@ -224,13 +380,8 @@ inline void core_ring_queue(int coreid, ring_ctx_t *ctx,
 
         ctx->group = -1;
         
-        libringbuf_sp_enqueue(ctx->request, (void *)ctx);
+        __core_ring_enqueue(core_self(), coreid, ctx->request, ctx);
 
-        if (unlikely(ltgconf_global.polling_timeout)) {
-                core_t *rcore = core_get(coreid);
-                sche_post(rcore->sche);
-        }
-        
         return ;
 }
 
@@ -262,7 +413,14 @@ inline int core_ring_wait(int coreid, int group, const char *name,
         DBUG("core ring request\n");
         
         (void) group;
-        
+
+        // backpressure, let the target drain before queueing more
+        core_t *core = core_self();
+        while (unlikely(core->ring->overflow[coreid].count >= RING_OVERFLOW_MAX)) {
+                core->ring->full++;
+                sche_task_sleep("ring_full", 100);
+        }
+
         va_start(request_ctx.ap, exec);
         request_ctx.exec = exec;
 
@@ -277,13 +435,8 @@ inline int core_ring_wait(int coreid, int group, const char *name,
         ctx->reply_ctx = (void *)&task;
         ctx->group = group;
         
-        libringbuf_sp_enqueue(ctx->request, (void *)ctx);
+        __core_ring_enqueue(core, coreid, ctx->request, ctx);
 
-        if (unlikely(ltgconf_global.polling_timeout)) {
-                core_t *rcore = core_get(coreid);
-                sche_post(rcore->sche);
-        }
-        
         ret = sche_yield1(name, NULL, NULL, NULL, -1);
         if (unlikely(ret))
                 GOTO(err_ret, ret);
@@ -296,3 +449,141 @@ inline int core_ring_wait(int coreid, int group, const char *name,
 err_ret:
         return ret;
 }
+
+typedef struct {
+        ring_ctx_t ring;
+        core_call_func_t func;
+        void *mem;              // core_call_async, allocated address
+        task_t task;
+        int retval;
+        char arg[CORE_CALL_ARG_MAX] __attribute__((__aligned__(8)));
+} core_call_t;
+
+static int __core_call_va(va_list ap)
+{
+        core_call_func_t func = va_arg(ap, core_call_func_t);
+        void *arg = va_arg(ap, void *);
+
+        va_end(ap);
+
+        return func(arg);
+}
+
+static void IO_FUNC __core_call_run__(void *_ctx)
+{
+        core_call_t *call = _ctx;
+
+        call->retval = call->func(call->arg);
+        call->ring.type = OP_REPLY;
+
+        __core_ring_enqueue(core_self(), call->ring.reply_coreid,
+                            call->ring.reply, &call->ring);
+}
+
+static void __core_call_reply(void *arg)
+{
+        core_call_t *call = arg;
+
+        sche_task_post(&call->task, 0, NULL);
+}
+
+static void __core_call_free(void *arg)
+{
+        core_call_t *call = arg;
+
+        slab_stream_free(call->mem);
+}
+
+static void __core_call_prep(int coreid, core_call_t *call, func_t reply,
+                             core_call_func_t func, const void *arg, int len)
+{
+        __core_ring_queue(coreid, &call->ring, NULL, NULL, reply, call);
+
+        call->ring.task_run = __core_call_run__;
+        call->ring.type = OP_CALL;
+        call->ring.group = -1;
+        call->func = func;
+        memcpy(call->arg, arg, len);
+}
+
+int IO_FUNC core_call(int coreid, const char *name, core_call_func_t func,
+                      void *arg, int len)
+{
+        int ret;
+        core_t *core = core_self();
+        core_call_t call;
+
+        LTG_ASSERT(len >= 0 && len <= CORE_CALL_ARG_MAX);
+
+        if (unlikely(core == NULL || !sche_running())) {
+                return core_request(coreid, -1, name, __core_call_va, func, arg);
+        }
+
+        if (core->hash == coreid) {
+                return func(arg);
+        }
+
+        while (unlikely(core->ring->overflow[coreid].count >= RING_OVERFLOW_MAX)) {
+                core->ring->full++;
+                sche_task_sleep("ring_full", 100);
+        }
+
+        __core_call_prep(coreid, &call, __core_call_reply, func, arg, len);
+
+        ret = sche_task_get1(sche_self(), &call.task);
+        LTG_ASSERT(ret == 0);
+
+        __core_ring_enqueue(core, coreid, call.ring.request, &call.ring);
+
+        ret = sche_yield1(name, NULL, NULL, NULL, -1);
+        if (unlikely(ret))
+                GOTO(err_ret, ret);
+
+        memcpy(arg, call.arg, len);
+
+        return call.retval;
+err_ret:
+        return ret;
+}
+
+/**
+ * the slot comes back to this core with the reply and is freed here, so
+ * no cross-core free is needed. without a slot it falls back to the
+ * blocking core_request and does not fail.
+ */
+int IO_FUNC core_call_async(int coreid, const char *name, core_call_func_t func,
+                            const void *arg, int len)
+{
+        void *mem;
+        core_t *core = core_self();
+        core_call_t *call;
+        char tmp[CORE_CALL_ARG_MAX];
+
+        LTG_ASSERT(len >= 0 && len <= CORE_CALL_ARG_MAX);
+
+        if (unlikely(core == NULL || core->hash == coreid)) {
+                memcpy(tmp, arg, len);
+                if (core) {
+                        return func(tmp);
+                }
+
+                return core_request(coreid, -1, name, __core_call_va, func, tmp);
+        }
+
+        mem = slab_stream_alloc(sizeof(*call) + CACHE_LINE_SIZE);
+        if (unlikely(mem == NULL)) {
+                // callers free memory through here and can not fail, wait
+                DWARN("%s to core[%d] no slot, wait\n", name, coreid);
+                memcpy(tmp, arg, len);
+                return core_request(coreid, -1, name, __core_call_va, func, tmp);
+        }
+
+        call = (void *)(((uintptr_t)mem + CACHE_LINE_SIZE - 1)
+                        & ~((uintptr_t)CACHE_LINE_SIZE - 1));
+        call->mem = mem;
+
+        __core_call_prep(coreid, call, __core_call_free, func, arg, len);
+        __core_ring_enqueue(core, coreid, call->ring.request, &call->ring);
+
+        return 0;
+}
@@ -25,9 +25,9 @@ define loop_sche
 set $count= sche->size
 set $i = 0
 while ($i < $count)
-if (sche->tasks[$i].state != TASK_STAT_FREE)
-print  sche->tasks[$i].name
-print  sche->tasks[$i].wait_name
+if (sche->tasks[$i / 1024][$i % 1024].state != TASK_STAT_FREE)
+print  sche->tasks[$i / 1024][$i % 1024].name
+print  sche->tasks[$i / 1024][$i % 1024].wait_name
 print $i
 end
 set $i = $i + 1
@@ -220,6 +220,113 @@ static void IO_FUNC __sche_queue__(sche_t *sche, taskctx_t *taskctx, int retval,
         }
 
         count_list_add_tail(&taskctx->hook, &sche->runable[taskctx->group]);
+        sche->group_stat[taskctx->group].queue++;
+}
+
+static sche_prof_t *__sche_prof_get(sche_t *sche, int type, const char *name)
+{
+        int ret;
+        uint32_t i, idx;
+        sche_prof_t *table, *prof;
+
+        table = sche->prof[type];
+        if (unlikely(table == NULL)) {
+                ret = ltg_malloc((void **)&table, sizeof(*prof) * SCHE_PROF_MAX);
+                if (unlikely(ret))
+                        return NULL;
+
+                memset(table, 0x0, sizeof(*prof) * SCHE_PROF_MAX);
+                __atomic_store_n(&sche->prof[type], table, __ATOMIC_RELEASE);
+        }
+
+        idx = hash_str(name);
+        for (i = 0; i < SCHE_PROF_MAX; i++) {
+                prof = &table[(idx + i) % SCHE_PROF_MAX];
+                if (prof->name[0] == '\0') {
+                        __atomic_store_n(&prof->seq, prof->seq + 1, __ATOMIC_RELAXED);
+                        __atomic_thread_fence(__ATOMIC_RELEASE);
+                        strncpy(prof->name, name, MAX_NAME_LEN - 1);
+                        __atomic_store_n(&prof->seq, prof->seq + 1, __ATOMIC_RELEASE);
+                        return prof;
+                }
+
+                if (strcmp(prof->name, name) == 0)
+                        return prof;
+        }
+
+        // table full, not profiled
+        return NULL;
+}
+
+/*
+ * owner only, seqlock so that sche_prof_snapshot never blocks the core
+ */
+static void __sche_prof_add(sche_t *sche, int type, const char *name, uint64_t tsc)
+{
+        int i;
+        uint64_t ns;
+        sche_prof_t *prof;
+
+        prof = __sche_prof_get(sche, type, name ? name : "unknown");
+        if (unlikely(prof == NULL))
+                return;
+
+        ns = tsc * 1000 / (sche->hz / (1000 * 1000));
+        i = ns <= 256 ? 0 : 64 - __builtin_clzll(ns - 1) - 8;
+        if (i >= SCHE_PROF_HIST)
+                i = SCHE_PROF_HIST - 1;
+
+        __atomic_store_n(&prof->seq, prof->seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        prof->count++;
+        prof->sum += ns;
+        if (ns > prof->max)
+                prof->max = ns;
+        prof->hist[i]++;
+
+        __atomic_store_n(&prof->seq, prof->seq + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * lock free copy of one profile table, safe from any thread
+ *
+ * @return entries copied
+ */
+int sche_prof_snapshot(sche_t *sche, int type, sche_prof_t *array, int max)
+{
+        int i, count = 0;
+        uint32_t seq;
+        sche_prof_t *table, *prof;
+
+        LTG_ASSERT(type >= 0 && type < SCHE_PROF_TYPE);
+
+        table = __atomic_load_n(&sche->prof[type], __ATOMIC_ACQUIRE);
+        if (table == NULL)
+                return 0;
+
+        for (i = 0; i < SCHE_PROF_MAX && count < max; i++) {
+                prof = &table[i];
+
+                while (1) {
+                        seq = __atomic_load_n(&prof->seq, __ATOMIC_ACQUIRE);
+                        if (unlikely(seq & 1))
+                                continue;
+
+                        memcpy(&array[count], prof, sizeof(*prof));
+                        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+                        if (likely(seq == __atomic_load_n(&prof->seq, __ATOMIC_RELAXED)))
+                                break;
+                }
+
+                if (array[count].name[0] == '\0')
+                        continue;
+
+                count++;
+        }
+
+        return count;
 }
 
 static void __sche_exec__(sche_t *sche, taskctx_t *taskctx)
@@ -231,6 +338,7 @@ static void __sche_exec__(sche_t *sche, taskctx_t *taskctx)
         taskctx->state = TASK_STAT_RUNNING;
 
         DBUG("swap in task[%u] %s\n", taskctx->id, taskctx->name);
+        TRACE(TRACE_TASK_RESUME, taskctx->id, taskctx->group, taskctx->name);
 
 #if SCHEDULE_TASKCTX_RUNTIME
         taskctx->rtime = get_rdtsc();
@@ -244,9 +352,32 @@ static void __sche_exec__(sche_t *sche, taskctx_t *taskctx)
         now = get_rdtsc();
         used = now - taskctx->rtime;
         sche->run_time += used;
+        sche->group_stat[taskctx->group].run_time += used;
         //__sche_check_running_used(sche, taskctx, used);
+
+        if (unlikely(sche->slice && used > sche->slice)) {
+                sche->c_overrun++;
+                __sche_prof_add(sche, SCHE_PROF_SLICE, taskctx->name, used);
+        }
+
+        if (unlikely(ltgconf_global.task_profile)) {
+                taskctx->cpu_time += used;
+                __sche_prof_add(sche, SCHE_PROF_RUN, taskctx->name, used);
+                if (taskctx->state == TASK_STAT_FREE) {
+                        __sche_prof_add(sche, SCHE_PROF_CPU, taskctx->name,
+                                        taskctx->cpu_time);
+                }
+        }
 #endif
 
+        sche->group_stat[taskctx->group].run++;
+
+        if (taskctx->state == TASK_STAT_FREE) {
+                TRACE(TRACE_TASK_EXIT, taskctx->id, 0, taskctx->name);
+                // task returned, we are back on the sche stack
+                sche_stack_put(sche, taskctx);
+        }
+
         sche->running_task = -1;
         sche->counter++;
 }
@@ -260,12 +391,12 @@ void sche_stack_assert(sche_t *_sche)
                 return;
         }
 
-        taskctx = &sche->tasks[sche->running_task];
+        taskctx = sche_taskctx(sche, sche->running_task);
         LTG_ASSERT(taskctx->state == TASK_STAT_RUNNING);
 
         DBUG("size %u\n", (int)((uint64_t)&taskctx - (uint64_t)taskctx->stack));
         LTG_ASSERT((int)((uint64_t)&taskctx - (uint64_t)taskctx->stack)
-                   > DEFAULT_STACK_SIZE / 4);
+                   > (int)taskctx->stack_size / 4);
 
         LTG_ASSERT(!memcmp(taskctx->stack, zerobuf, KEEP_STACK_SIZE));
 }
@@ -335,9 +466,11 @@ int IO_FUNC sche_yield1(const char *name, ltgbuf_t *buf, void *opaque, func_t fu
         struct timeval now;
 #endif
         struct timeval t1, t2;
-        uint64_t used;
+        uint64_t used, yield_time = 0;
 
         LTG_ASSERT(_tmo < 1000);
+        // nonblocking handlers run inline and must not yield
+        LTG_ASSERT(sche->nonblock == 0);
 
 #if ENABLE_SCHEDULE_STACK_ASSERT
         sche_stack_assert(sche);
@@ -346,7 +479,7 @@ int IO_FUNC sche_yield1(const char *name, ltgbuf_t *buf, void *opaque, func_t fu
         LTG_ASSERT(sche->running_task != -1);
         _gettimeofday(&t1, NULL);
 
-        taskctx = &sche->tasks[sche->running_task];
+        taskctx = sche_taskctx(sche, sche->running_task);
         LTG_ASSERT(taskctx->state == TASK_STAT_RUNNING);
         taskctx->pre_yield = 0;
         taskctx->state = TASK_STAT_SUSPEND;
@@ -356,6 +489,12 @@ int IO_FUNC sche_yield1(const char *name, ltgbuf_t *buf, void *opaque, func_t fu
         taskctx->wait_opaque = opaque;
         taskctx->step++;
 
+        if (unlikely(ltgconf_global.task_profile)) {
+                yield_time = get_rdtsc();
+        }
+
+        TRACE(TRACE_TASK_YIELD, taskctx->id, 0, name);
+
 retry:
 
 #if ENABLE_SCHEDULE_DEBUG
@@ -399,6 +538,10 @@ retry:
         used = _time_used(&t1, &t2);
         __sche_check_yield_used(sche, taskctx, used);
 
+        if (unlikely(yield_time)) {
+                __sche_prof_add(sche, SCHE_PROF_WAIT, name, get_rdtsc() - yield_time);
+        }
+
         return taskctx->retval;
 }
 
@@ -407,6 +550,45 @@ int IO_FUNC sche_yield(const char *name, ltgbuf_t *buf, void *opaque)
         return sche_yield1(name, buf, opaque, NULL, -1);
 }
 
+int IO_FUNC sche_maybe_yield()
+{
+#if SCHEDULE_TASKCTX_RUNTIME
+        sche_t *sche = sche_self();
+        taskctx_t *taskctx;
+        task_t task;
+
+        if (likely(sche == NULL || sche->slice == 0))
+                return 0;
+
+        if (unlikely(sche->running_task == -1 || sche->nonblock))
+                return 0;
+
+        taskctx = sche_taskctx(sche, sche->running_task);
+        if (likely(get_rdtsc() - taskctx->rtime < sche->slice))
+                return 0;
+
+        // a waker holds our fingerprint, yielding here would make it stale
+        if (unlikely(taskctx->pre_yield || taskctx->posted))
+                return 0;
+
+        // back to the tail of runable after the next poll, ring and
+        // network work queued meanwhile runs first
+        sche->c_preempt++;
+        task = sche_task_get();
+        sche_task_post(&task, 0, NULL);
+        if (likely(sche->poll_seq)) {
+                count_list_del(&taskctx->hook, &sche->reply_local);
+                count_list_add_tail(&taskctx->hook, &sche->reply_defer);
+                sche->defer_seq = sche->poll_seq;
+        }
+        sche_yield("maybe_yield", NULL, NULL);
+
+        return 1;
+#else
+        return 0;
+#endif
+}
+
 static void  __sche_backtrace_set(taskctx_t *taskctx)
 {
         sche_t *sche = taskctx->sche;
@@ -431,7 +613,7 @@ static int IO_FUNC __sche_queue(sche_t *sche, const task_t  *task, int retval,
         taskctx_t *taskctx;
 
         LTG_ASSERT(task->taskid >= 0 && task->taskid < TASK_MAX);
-        taskctx = &sche->tasks[task->taskid];
+        taskctx = sche_taskctx(sche, task->taskid);
 
         DBUG("run task %s, id [%u][%u]\n", taskctx->name, sche->id, taskctx->id);
 
@@ -460,8 +642,10 @@ static int __sche_task_wait(sche_t *sche)
 {
         int count = 0;
 
-        count += sche->request_queue.count;
+        count += libringbuf_count(sche->request_queue.queue);
+        count += sche->steal_deque->bottom - sche->steal_deque->top;
         count += sche->reply_local.count;
+        count += sche->reply_defer.count;
 
         struct list_head *pos;
         int ret = ltg_spin_lock(&sche->reply_remote_lock);
@@ -474,6 +658,11 @@ static int __sche_task_wait(sche_t *sche)
 
         ltg_spin_unlock(&sche->reply_remote_lock);
 
+        for (int i = 0; i < sche->reply_ring_count; i++) {
+                reply_ring_t *ring = sche->reply_ring_array[i];
+                count += ring->head - ring->tail;
+        }
+
         return count;
 }
 
@@ -557,20 +746,76 @@ static inline int __sche_isfree(taskctx_t *taskctx)
                 return 0;
 }
 
+static struct ringbuf *__sche_request_ring(int node, unsigned flags)
+{
+        int ret;
+        struct ringbuf *ringbuf;
+
+        ret = ltg_malloc_node((void **)&ringbuf,
+                              libringbuf_get_memsize(REQUEST_QUEUE_MAX), node);
+        if (unlikely(ret))
+                return NULL;
+
+        ret = libringbuf_init(ringbuf, REQUEST_QUEUE_MAX, flags);
+        if (unlikely(ret)) {
+                ltg_free((void **)&ringbuf);
+                return NULL;
+        }
+
+        return ringbuf;
+}
+
+/*
+ * producers are remote cores, the queue is placed on the node of the
+ * consumer, see core_ring.c.
+ */
+static int __sche_request_queue_init(request_queue_t *request_queue, int node)
+{
+        int ret;
+        request_t *request;
+
+        // ringbuf keeps one slot empty
+        ret = ltg_malloc_node((void **)&request_queue->requests,
+                              sizeof(*request) * (REQUEST_QUEUE_MAX - 1), node);
+        if (unlikely(ret))
+                GOTO(err_ret, ret);
+
+        request_queue->queue = __sche_request_ring(node, RING_F_SC_DEQ);
+        request_queue->free = __sche_request_ring(node, RING_F_SP_ENQ);
+        if (unlikely(request_queue->queue == NULL || request_queue->free == NULL)) {
+                ret = ENOMEM;
+                GOTO(err_ret, ret);
+        }
+
+        for (int i = 0; i < REQUEST_QUEUE_MAX - 1; i++) {
+                request = &request_queue->requests[i];
+                ret = libringbuf_sp_enqueue(request_queue->free, request);
+                LTG_ASSERT(ret == 0);
+        }
+
+        request_queue->hwm = 0;
+        request_queue->full = 0;
+
+        return 0;
+err_ret:
+        return ret;
+}
+
 static int __sche_create__(sche_t **_sche, const char *name, int idx,
                            void *private_mem, int *_eventfd)
 {
         int ret, fd, i;
         sche_t *sche;
-        taskctx_t *taskctx;
+        core_t *core = core_self();
 
         (void) private_mem;
 
-        ret = ltg_malloc((void **)&sche, sizeof(*sche));
+        ret = ltg_malloc_local((void **)&sche, sizeof(*sche));
         if (unlikely(ret))
                 GOTO(err_ret, ret);
 
         memset(sche, 0x0, sizeof(*sche));
+        sche->node = (core && core->main_core) ? core->main_core->node_id : -1;
 
         if (_eventfd) {
                 fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
@@ -584,17 +829,36 @@ static int __sche_create__(sche_t **_sche, const char *name, int idx,
                 fd = -1;
         }
 
-        ret = ltg_spin_init(&sche->request_queue.lock);
+        ret = __sche_request_queue_init(&sche->request_queue, sche->node);
+        if (unlikely(ret))
+                GOTO(err_ret, ret);
+
+        ret = ltg_malloc_local((void **)&sche->steal_deque, sizeof(*sche->steal_deque));
         if (unlikely(ret))
                 GOTO(err_ret, ret);
 
+        sche->steal_deque->top = 0;
+        sche->steal_deque->bottom = 0;
+
         ret = ltg_spin_init(&sche->reply_remote_lock);
         if (unlikely(ret))
                 GOTO(err_ret, ret);
 
         INIT_LIST_HEAD(&sche->reply_remote_list);
-        sche->task_hpage = NULL;
-        sche->task_hpage_offset = 0;
+
+        ret = ltg_malloc((void **)&sche->reply_ring,
+                         sizeof(*sche->reply_ring) * SCHEDULE_MAX);
+        if (unlikely(ret))
+                GOTO(err_ret, ret);
+
+        ret = ltg_malloc((void **)&sche->reply_ring_array,
+                         sizeof(*sche->reply_ring_array) * SCHEDULE_MAX);
+        if (unlikely(ret))
+                GOTO(err_ret, ret);
+
+        memset(sche->reply_ring, 0x0, sizeof(*sche->reply_ring) * SCHEDULE_MAX);
+        sche->reply_ring_count = 0;
+        sche->reply_remote_count = 0;
        
         sche->running_task = -1;
         sche->task_count = 0;
@@ -603,33 +867,35 @@ static int __sche_create__(sche_t **_sche, const char *name, int idx,
         sche->suspendable = 0;
         strcpy(sche->name, name);
 
-#if 1
-        ret = ltg_malloc((void **)&taskctx, sizeof(*taskctx) * TASK_MAX);
+        ret = ltg_malloc((void **)&sche->tasks,
+                         sizeof(*sche->tasks) * (TASK_MAX / TASK_CHUNK));
         if (unlikely(ret))
                 GOTO(err_ret, ret);
-#endif
 
-        LTG_ASSERT(taskctx);
-        memset(taskctx, 0x0, sizeof(*taskctx) * TASK_MAX);
+        memset(sche->tasks, 0x0, sizeof(*sche->tasks) * (TASK_MAX / TASK_CHUNK));
+        sche->size = 0;
 
         INIT_LIST_HEAD(&sche->running_task_list);
         count_list_init(&sche->free_task);
 
-        for (i = 0; i < TASK_MAX; ++i) {
-                taskctx[i].id = i;
-                taskctx[i].stack = NULL;
-                taskctx[i].state = TASK_STAT_FREE;
-                count_list_add_tail(&taskctx[i].running_hook, &sche->free_task);
-        }
+        ret = sche_taskctx_grow(sche);
+        if (unlikely(ret))
+                GOTO(err_ret, ret);
+
+        sche_stack_init(sche);
 
         count_list_init(&sche->wait_task);
+        count_list_init(&sche->reply_local);
+        count_list_init(&sche->reply_defer);
         for (i = 0; i < SCHE_GROUP_MAX; i++) {
                 count_list_init(&sche->runable[i]);
         }
 
-        sche->tasks = taskctx;
+        ret = sche_policy_set(sche, SCHE_POLICY_STRICT, NULL);
+        if (unlikely(ret))
+                GOTO(err_ret, ret);
+
         sche->running = 1;
-        sche->size = TASK_MAX;
 
         __sche__ = sche;
         if (_sche)
@@ -670,6 +936,7 @@ static int __sche_create(int *eventfd, const char *name, int idx,
                 GOTO(err_lock, ret);
 #if SCHEDULE_TASKCTX_RUNTIME
         sche->hz = cpu_freq_init();
+        sche->slice = (uint64_t)ltgconf_global.task_slice * (sche->hz / (1000 * 1000));
 #endif
         DINFO("sche hz is %lu\n", sche->hz);
         __sche_array__[idx] = sche;
@@ -728,62 +995,163 @@ inline static taskctx_t * IO_FUNC __sche_task_pop(sche_t *sche, int group)
 }
 
 
-static int IO_FUNC __sche_group_run(sche_t *sche, int group)
+static void IO_FUNC __sche_group_exec(sche_t *sche, taskctx_t *taskctx)
 {
-        int count = 0;
+#if SCHEDULE_CHECK_IOPS
+        int64_t used;
+
+        sche->nr_run2++;
+        if (sche->nr_run2 % 10000 == 0) {
+                used = _time_used(&sche->t1, &sche->t2);
+                if (used >= 1000000) {
+                        DDUG("sche %p name %s run1 %ju run2 %ju iops %ju\n",
+                             sche, taskctx->name,
+                             sche->nr_run1, sche->nr_run2,
+                             (sche->nr_run2 - sche->nr_run1) / used);
+                        sche->t1 = sche->t2;
+                        sche->nr_run1 = sche->nr_run2;
+                }
+        }
+#endif
+
+        LTG_ASSERT(taskctx->state == TASK_STAT_RUNNABLE);
+        __sche_exec__(sche, taskctx);
+}
+
+static void IO_FUNC __sche_reply_local_run(sche_t *sche);
+
+/**
+ * always pick from the highest non-empty group, local replies are
+ * requeued before each pick so a resumed high-priority task does not wait
+ * behind the rest of a lower group
+ */
+static int IO_FUNC __sche_strict_run(sche_t *sche)
+{
+        int count = 0, i;
         taskctx_t *taskctx;
 
         while (1) {
-                taskctx = __sche_task_pop(sche, group);
-                if (unlikely(taskctx == NULL)) {
-                        break;
+                if (sche->reply_local.count) {
+                        __sche_reply_local_run(sche);
                 }
 
-#if SCHEDULE_CHECK_IOPS
-                int64_t used;
-
-                sche->nr_run2++;
-                if (sche->nr_run2 % 10000 == 0) {
-                        used = _time_used(&sche->t1, &sche->t2);
-                        if (used >= 1000000) {
-                                DDUG("sche %p name %s run1 %ju run2 %ju iops %ju\n",
-                                     sche, taskctx->name,
-                                     sche->nr_run1, sche->nr_run2,
-                                     (sche->nr_run2 - sche->nr_run1) / used);
-                                sche->t1 = sche->t2;
-                                sche->nr_run1 = sche->nr_run2;
-                        }
+                taskctx = NULL;
+                for (i = 0; i < SCHE_GROUP_MAX; i++) {
+                        taskctx = __sche_task_pop(sche, i);
+                        if (taskctx)
+                                break;
+                }
+
+                if (unlikely(taskctx == NULL)) {
+                        break;
                 }
-#endif
 
                 count++;
-                LTG_ASSERT(taskctx->state == TASK_STAT_RUNNABLE);
-                __sche_exec__(sche, taskctx);
+                __sche_group_exec(sche, taskctx);
+        }
+
+        return count;
+}
+
+/**
+ * one round, each group runs up to weight tasks
+ */
+static int IO_FUNC __sche_wfq_run(sche_t *sche)
+{
+        int count = 0, i, j;
+        taskctx_t *taskctx;
+
+        if (sche->reply_local.count) {
+                __sche_reply_local_run(sche);
+        }
+
+        for (i = 0; i < SCHE_GROUP_MAX; i++) {
+                for (j = 0; j < sche->weight[i]; j++) {
+                        taskctx = __sche_task_pop(sche, i);
+                        if (taskctx == NULL)
+                                break;
+
+                        count++;
+                        __sche_group_exec(sche, taskctx);
+                }
         }
 
         return count;
 }
 
+int sche_policy_set(sche_t *sche, int policy, const int *weight)
+{
+        int ret, i;
+        int def[SCHE_GROUP_MAX] = SCHE_GROUP_WEIGHT;
+
+        if (unlikely(policy != SCHE_POLICY_STRICT && policy != SCHE_POLICY_WFQ)) {
+                ret = EINVAL;
+                GOTO(err_ret, ret);
+        }
+
+        if (weight == NULL)
+                weight = def;
+
+        for (i = 0; i < SCHE_GROUP_MAX; i++) {
+                if (unlikely(weight[i] <= 0)) {
+                        ret = EINVAL;
+                        GOTO(err_ret, ret);
+                }
+        }
+
+        for (i = 0; i < SCHE_GROUP_MAX; i++) {
+                sche->weight[i] = weight[i];
+        }
+
+        sche->policy = policy;
+
+        DINFO("%s[%u] policy %s weight %u/%u/%u/%u\n", sche->name, sche->id,
+              policy == SCHE_POLICY_WFQ ? "wfq" : "strict",
+              sche->weight[0], sche->weight[1], sche->weight[2], sche->weight[3]);
+
+        return 0;
+err_ret:
+        return ret;
+}
+
+void sche_group_stat(sche_t *sche, int group, sche_group_stat_t *stat)
+{
+        LTG_ASSERT(group >= 0 && group < SCHE_GROUP_MAX);
+
+        *stat = sche->group_stat[group];
+#if SCHEDULE_TASKCTX_RUNTIME
+        stat->run_time = (stat->run_time * 1000 * 1000) / sche->hz;
+#endif
+}
+
 static void __sche_request_queue_run(sche_t *sche)
 {
-        int ret, count, i;
+        uint32_t i, count, depth;
         request_queue_t *request_queue = &sche->request_queue;
-        request_t _request[REQUEST_QUEUE_MAX], *request;
-        
-        ret = ltg_spin_lock(&request_queue->lock);
-        if (unlikely(ret))
-                UNIMPLEMENTED(__DUMP__);
+        request_t *request, *array[REQUEST_QUEUE_BATCH];
+
+        depth = libringbuf_count(request_queue->queue);
+        if (unlikely(depth > request_queue->hwm)) {
+                request_queue->hwm = depth;
+        }
 
-        memcpy(_request, request_queue->requests, sizeof(request_t)
-               * request_queue->count);
-        count = request_queue->count;
-        request_queue->count = 0;
-        ltg_spin_unlock(&request_queue->lock);
+        while (1) {
+                count = libringbuf_sc_dequeue_burst(request_queue->queue,
+                                                    (void **)array,
+                                                    REQUEST_QUEUE_BATCH);
+                if (count == 0)
+                        break;
 
-        for (i = 0; i < count; ++i) {
-                request = &_request[i];
-                sche_task_new(request->name, request->exec,
-                              request->arg, request->group);
+                for (i = 0; i < count; ++i) {
+                        request = array[i];
+                        sche_task_new(request->name, request->exec,
+                                      request->arg, request->group);
+                }
+
+                // name was copied by sche_task_new, give entries back at once
+                i = libringbuf_sp_enqueue_burst(request_queue->free,
+                                                (void **)array, count);
+                LTG_ASSERT(i == count);
         }
 }
 
@@ -812,66 +1180,261 @@ static void __sche_reply_remote_run(sche_t *sche)
                         LTG_ASSERT(ret == ESTALE);
                 }
 
+                sche->reply_remote_count++;
                 ltg_free((void **)&reply);
         }
 }
 
-static void IO_FUNC __sche_reply_local_run(sche_t *sche)
+static void IO_FUNC __sche_reply_ring_run__(sche_t *sche, reply_ring_t *ring)
 {
-        int ret, count = 0, i;
-        reply_queue_t *reply_local = &sche->reply_local;
-        reply_t _reply[REPLY_QUEUE_MAX], *reply;
+        int ret;
+        uint32_t head, tail;
+        reply_remote_t *reply;
+
+        tail = ring->tail;
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (likely(head == tail)) {
+                return;
+        }
 
-        LTG_ASSERT(reply_local->count <= REPLY_QUEUE_MAX);
-        memcpy(_reply, reply_local->replys, sizeof(reply_t) * reply_local->count);
-        count = reply_local->count;
-        reply_local->count = 0;
+        for (; tail != head; tail++) {
+                reply = &ring->entry[tail % REPLY_RING_SIZE];
 
-        for (i = 0; i < count; ++i) {
-                reply = &_reply[i];
-                DBUG("**** rep %u\n", reply->task.taskid);
-                ret = __sche_queue(sche, &reply->task, reply->retval, reply->buf, 0);
+                ret = __sche_queue(sche, &reply->task, reply->retval, &reply->buf, 0);
                 if (unlikely(ret)) {
                         LTG_ASSERT(ret == ESTALE);
+                        ltgbuf_free(&reply->buf);
                 }
 
-                slab_stream_free(reply->buf);
+                sche->reply_remote_count++;
+        }
+
+        // release the whole batch to the producer at once
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+}
+
+static void IO_FUNC __sche_reply_ring_run(sche_t *sche, int count)
+{
+        for (int i = 0; i < count; i++) {
+                __sche_reply_ring_run__(sche, sche->reply_ring_array[i]);
+        }
+}
+
+static void IO_FUNC __sche_reply_local_run(sche_t *sche)
+{
+        taskctx_t *taskctx;
+        count_list_t *reply_local = &sche->reply_local;
+
+        while (!list_empty(&reply_local->list)) {
+                taskctx = (void *)reply_local->list.next;
+                count_list_del(&taskctx->hook, reply_local);
+
+                DBUG("**** rep %u\n", taskctx->id);
+
+                LTG_ASSERT(taskctx->posted);
+                LTG_ASSERT(taskctx->state == TASK_STAT_SUSPEND);
+                taskctx->posted = 0;
+                taskctx->state = TASK_STAT_RUNNABLE;
+                count_list_add_tail(&taskctx->hook, &sche->runable[taskctx->group]);
+                sche->group_stat[taskctx->group].queue++;
         }
 }
 
 static int IO_FUNC __sche_run(sche_t *sche)
 {
-        int count = 0;
+        if (sche->policy == SCHE_POLICY_WFQ) {
+                return __sche_wfq_run(sche);
+        } else {
+                return __sche_strict_run(sche);
+        }
+}
 
-        if (sche->reply_local.count) {
-                __sche_reply_local_run(sche);
+int IO_FUNC sche_steal_push(sche_t *sche, const steal_task_t *task)
+{
+        int64_t b, t;
+        steal_deque_t *deque = sche->steal_deque;
+
+        b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+        t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+        if (unlikely(b - t >= SCHE_DEQUE_SIZE))
+                return ENOSPC;
+
+        deque->entry[b & (SCHE_DEQUE_SIZE - 1)] = *task;
+        __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELEASE);
+
+        return 0;
+}
+
+static int IO_FUNC __sche_steal_pop(steal_deque_t *deque, steal_task_t *task)
+{
+        int ret = 0;
+        int64_t b, t;
+
+        b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+        __atomic_store_n(&deque->bottom, b, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        t = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+        if (t > b) {
+                // empty
+                __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+                return ENOENT;
+        }
+
+        *task = deque->entry[b & (SCHE_DEQUE_SIZE - 1)];
+        if (t == b) {
+                // last one, race with thieves
+                if (!__atomic_compare_exchange_n(&deque->top, &t, t + 1, 0,
+                                                 __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+                        ret = ENOENT;
+                }
+
+                __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+        }
+
+        return ret;
+}
+
+static int __sche_steal_take(steal_deque_t *deque, steal_task_t *task)
+{
+        int64_t b, t;
+
+        t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        b = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+
+        if (t >= b)
+                return ENOENT;
+
+        // the copy may be torn if the slot was reused, then the CAS fails
+        *task = deque->entry[t & (SCHE_DEQUE_SIZE - 1)];
+        if (!__atomic_compare_exchange_n(&deque->top, &t, t + 1, 0,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+                return EAGAIN;
         }
 
-        for (int i = 0; i < SCHE_GROUP_MAX; i++) {
-                count += __sche_group_run(sche, i);
+        return 0;
+}
+
+/*
+ * the owner starts one task while it has other work, up to
+ * SCHE_STEAL_BATCH when idle, the rest is left to thieves.
+ */
+static void IO_FUNC __sche_steal_run(sche_t *sche)
+{
+        int ret, i, max;
+        steal_task_t task;
+
+        max = __sche_runable(sche) ? 1 : SCHE_STEAL_BATCH;
+        for (i = 0; i < max; i++) {
+                ret = __sche_steal_pop(sche->steal_deque, &task);
+                if (ret)
+                        break;
+
+                sche_task_new1(task.name, task.func, task.arg, task.group,
+                               task.stack_class);
         }
+}
+
+/**
+ * called by an idle sche, start at most max migratable tasks of victim here
+ *
+ * @return tasks stolen
+ */
+int sche_steal(sche_t *sche, sche_t *victim, int max)
+{
+        int ret, count = 0;
+        steal_task_t task;
+        steal_deque_t *deque = victim->steal_deque;
+
+        LTG_ASSERT(sche == sche_self() && sche != victim);
+
+        while (count < max) {
+                ret = __sche_steal_take(deque, &task);
+                if (ret == ENOENT) {
+                        break;
+                } else if (ret == EAGAIN) {
+                        sche->steal_fail++;
+                        break;
+                }
+
+                DBUG("%s[%u] steal %s from %s[%u]\n", sche->name, sche->id,
+                     task.name, victim->name, victim->id);
+
+                sche_task_new1(task.name, task.func, task.arg, task.group,
+                               task.stack_class);
+                count++;
+        }
+
+        sche->steal += count;
 
         return count;
 }
 
+static inline int __sche_steal_empty(sche_t *sche)
+{
+        steal_deque_t *deque = sche->steal_deque;
+
+        return __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED)
+                <= __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+}
+
+static void IO_FUNC __sche_reply_defer_run(sche_t *sche)
+{
+        taskctx_t *taskctx;
+        count_list_t *reply_defer = &sche->reply_defer;
+
+        while (!list_empty(&reply_defer->list)) {
+                taskctx = (void *)reply_defer->list.next;
+                count_list_del(&taskctx->hook, reply_defer);
+                count_list_add_tail(&taskctx->hook, &sche->reply_local);
+        }
+}
+
 void IO_FUNC sche_run(sche_t *_sche)
 {
         int count;
         sche_t *sche = __sche_self(_sche);
-        
+
+        // preempted before the last poll
+        if (unlikely(sche->reply_defer.count
+                     && sche->defer_seq != sche->poll_seq)) {
+                __sche_reply_defer_run(sche);
+        }
+
+        count = __atomic_load_n(&sche->reply_ring_count, __ATOMIC_ACQUIRE);
+        if (likely(count)) {
+                __sche_reply_ring_run(sche, count);
+        }
+
         if (unlikely(!list_empty(&sche->reply_remote_list))) {
                 __sche_reply_remote_run(sche);
         }
 
-        if (unlikely(sche->request_queue.count)) {
+        if (unlikely(!libringbuf_empty(sche->request_queue.queue))) {
                 __sche_request_queue_run(sche);
         }
+
+        if (unlikely(!__sche_steal_empty(sche))) {
+                __sche_steal_run(sche);
+        }
         
         do {
                 count = __sche_run(sche);
         } while (count);
 }
 
+/*
+ * the core has polled its pollers, tasks preempted before now may run
+ * again. a sche nobody calls this for keeps preempted tasks in reply_local.
+ */
+void IO_FUNC sche_polled(sche_t *sche)
+{
+        sche->poll_seq++;
+        if (unlikely(sche->poll_seq == 0))
+                sche->poll_seq = 1;
+}
+
 void IO_FUNC sche_post(sche_t *sche)
 {
         int ret;
@@ -879,6 +1442,15 @@ void IO_FUNC sche_post(sche_t *sche)
 
         DBUG("eventfd %d\n", sche->eventfd);
         if (unlikely(sche->eventfd != -1)) {
+                if (sche->hybrid) {
+                        // pairs with the fence in sche_arm
+                        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+                        if (likely(!__atomic_load_n(&sche->armed, __ATOMIC_RELAXED)))
+                                return;
+
+                        __atomic_store_n(&sche->post_time, get_rdtsc(), __ATOMIC_RELAXED);
+                }
+
                 ret = write(sche->eventfd, &e, sizeof(e));
                 if (ret < 0) {
                         ret = errno;
@@ -888,6 +1460,65 @@ void IO_FUNC sche_post(sche_t *sche)
         }
 }
 
+static int __sche_pending(sche_t *sche)
+{
+        int i, count;
+        reply_ring_t *ring;
+
+        if (!libringbuf_empty(sche->request_queue.queue)
+            || !__sche_steal_empty(sche)
+            || !list_empty(&sche->reply_remote_list)
+            || sche->reply_local.count
+            || sche->reply_defer.count)
+                return 1;
+
+        for (i = 0; i < SCHE_GROUP_MAX; i++) {
+                if (sche->runable[i].count)
+                        return 1;
+        }
+
+        count = __atomic_load_n(&sche->reply_ring_count, __ATOMIC_ACQUIRE);
+        for (i = 0; i < count; i++) {
+                ring = sche->reply_ring_array[i];
+                if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != ring->tail)
+                        return 1;
+        }
+
+        return 0;
+}
+
+void sche_hybrid_set(sche_t *sche)
+{
+        LTG_ASSERT(sche->eventfd != -1);
+        sche->hybrid = 1;
+        sche->armed = 0;
+}
+
+/**
+ * hybrid polling, make sche_post write the eventfd before the owner blocks.
+ *
+ * @return EAGAIN if work is already queued, the caller must not block
+ */
+int sche_arm(sche_t *sche)
+{
+        LTG_ASSERT(sche->hybrid);
+
+        __atomic_store_n(&sche->armed, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        if (__sche_pending(sche)) {
+                __atomic_store_n(&sche->armed, 0, __ATOMIC_RELAXED);
+                return EAGAIN;
+        }
+
+        return 0;
+}
+
+void sche_disarm(sche_t *sche)
+{
+        __atomic_store_n(&sche->armed, 0, __ATOMIC_RELAXED);
+}
+
 void sche_task_given(task_t *task)
 {
         if (likely(sche_running())) {
@@ -903,6 +1534,10 @@ void sche_task_given(task_t *task)
         }
 }
 
+/**
+ * non-blocking, returns EAGAIN if the request queue of sche is full.
+ * may be called from any thread.
+ */
 int sche_request(sche_t *sche, int group, func_t exec, void *arg, const char *name)
 {
         int ret;
@@ -911,59 +1546,83 @@ int sche_request(sche_t *sche, int group, func_t exec, void *arg, const char *na
 
         LTG_ASSERT(strlen(name) + 1 <= SCHE_NAME_LEN);
 
-        ret = ltg_spin_lock(&request_queue->lock);
-        if (unlikely(ret))
-                UNIMPLEMENTED(__DUMP__);
-
-        if (request_queue->count == request_queue->max) {
-                if (request_queue->count + REQUEST_QUEUE_STEP == REQUEST_QUEUE_MAX) {
-                        ret = ENOSPC;
-                        UNIMPLEMENTED(__DUMP__);
-                        GOTO(err_lock, ret);
-                }
-
-                DINFO("new request_queue array %u\n", request_queue->max + REQUEST_QUEUE_STEP);
-
-                ret = ltg_realloc((void **)&request_queue->requests,
-                               sizeof(*request) * request_queue->max,
-                               sizeof(*request) * (request_queue->max + REQUEST_QUEUE_STEP));
-                if (unlikely(ret))
-                        UNIMPLEMENTED(__DUMP__);
-
-                request_queue->max += REQUEST_QUEUE_STEP;
+        ret = libringbuf_mc_dequeue(request_queue->free, (void **)&request);
+        if (unlikely(ret)) {
+                __sync_fetch_and_add(&request_queue->full, 1);
+                ret = EAGAIN;
+                goto err_ret;
         }
 
-        DBUG("count %u max %u\n", request_queue->count, request_queue->max);
-
-        request = &request_queue->requests[request_queue->count];
         request->exec = exec;
         request->arg = arg;
         request->group = group;
         snprintf(request->name, SCHE_NAME_LEN, "%s", name);
-        request_queue->count++;
 
-        ltg_spin_unlock(&request_queue->lock);
+        // the queue holds as many slots as there are entries
+        ret = libringbuf_mp_enqueue(request_queue->queue, request);
+        LTG_ASSERT(ret == 0);
 
         sche_post(sche);
 
         return 0;
-err_lock:
-        ltg_spin_unlock(&request_queue->lock);
-//err_ret:
+err_ret:
         return ret;
 }
 
+/**
+ * sche_request, retry while the queue is full. a task that already holds
+ * its own task_t (pre_yield) can not sleep, it falls back to usleep.
+ */
+int sche_request_wait(sche_t *sche, int group, func_t exec, void *arg, const char *name)
+{
+        int ret, retry = 0;
+
+        while (1) {
+                ret = sche_request(sche, group, exec, arg, name);
+                if (likely(ret != EAGAIN))
+                        break;
+
+                if (retry % 1000 == 0) {
+                        DWARN("%s[%u] request queue full, %s retry %u\n",
+                              sche->name, sche->id, name, retry);
+                }
+
+                retry++;
+
+                if (sche == sche_self()) {
+                        // we are the consumer, make room ourself
+                        __sche_request_queue_run(sche);
+                } else if (sche_running()
+                           && !sche_taskctx(sche_self(), sche_self()->running_task)->pre_yield) {
+                        sche_task_sleep("request_full", 100);
+                } else {
+                        usleep(100);
+                }
+        }
+
+        return ret;
+}
+
+void sche_request_stat(sche_t *sche, int *depth, int *hwm, uint64_t *full)
+{
+        request_queue_t *request_queue = &sche->request_queue;
+
+        *depth = libringbuf_count(request_queue->queue);
+        *hwm = request_queue->hwm;
+        *full = request_queue->full;
+}
+
 void sche_dump(sche_t *sche, int block)
 {
         int i, count = 0;
         taskctx_t *taskctx;
         struct timeval t1;
         uint64_t used;
-        taskctx_t *tasks = sche->tasks;
+        taskctx_t *tmp;
 
         _gettimeofday(&t1, NULL);
 
-        list_for_each_entry_safe(taskctx, tasks, &sche->running_task_list, running_hook) {
+        list_for_each_entry_safe(taskctx, tmp, &sche->running_task_list, running_hook) {
                 i = taskctx->id;
                 if (taskctx->state != TASK_STAT_FREE) {
                         count ++;
@@ -993,12 +1652,12 @@ void IO_FUNC sche_scan(sche_t *_sche)
 {
         int i, time_used, used = 0;
         sche_t *sche = __sche_self(_sche);
-        taskctx_t *taskctx, *tasks = sche->tasks;
+        taskctx_t *taskctx, *tmp;
 
         LTG_ASSERT(sche);
 
         (void) i;
-        list_for_each_entry_safe(taskctx, tasks, &sche->running_task_list, running_hook) {
+        list_for_each_entry_safe(taskctx, tmp, &sche->running_task_list, running_hook) {
                 i = taskctx->id;
                 if (likely(taskctx->state != TASK_STAT_FREE && taskctx->wait_begin)) {
                         time_used = gettime() - taskctx->wait_begin;
@@ -1014,7 +1673,7 @@ void sche_backtrace()
 {
         int i;
         sche_t *sche = sche_self();
-        taskctx_t *taskctx, *tasks = sche->tasks;
+        taskctx_t *taskctx, *tmp;
 
         if (!sche->backtrace) {
                 return;
@@ -1024,7 +1683,7 @@ void sche_backtrace()
 
         LTG_ASSERT(sche);
 
-        list_for_each_entry_safe(taskctx, tasks, &sche->running_task_list, running_hook) {
+        list_for_each_entry_safe(taskctx, tmp, &sche->running_task_list, running_hook) {
                 i = taskctx->id;
                 int time_used = gettime() - taskctx->wait_begin;
                 if (taskctx->state != TASK_STAT_FREE) {
@@ -1075,7 +1734,7 @@ void sche_lock_set(int lock, int ref)
 
         LTG_ASSERT(sche);
         LTG_ASSERT(sche->running_task != -1);
-        taskctx = &sche->tasks[sche->running_task];
+        taskctx = sche_taskctx(sche, sche->running_task);
 
         if (lock) {
                 taskctx->lock_count += lock;
@@ -1099,7 +1758,7 @@ int sche_assert_retry()
                 return 0;
         }
 
-        taskctx = &sche->tasks[sche->running_task];
+        taskctx = sche_taskctx(sche, sche->running_task);
         // TODO core
         LTG_ASSERT(taskctx->lock_count == 0);
         if (taskctx->ref_count) {
@@ -1119,7 +1778,7 @@ void sche_value_set(int key, uint32_t value)
 
         if (unlikely(!(sche && sche->running_task != -1))) {
         } else {
-                taskctx = &sche->tasks[sche->running_task];
+                taskctx = sche_taskctx(sche, sche->running_task);
                 taskctx->value[key] = value;
         }
 }
@@ -1134,7 +1793,7 @@ void sche_value_get(int key, uint32_t *value)
         if (!(sche && sche->running_task != -1)) {
                 *value = -1;
         } else {
-                taskctx = &sche->tasks[sche->running_task];
+                taskctx = sche_taskctx(sche, sche->running_task);
                 *value = taskctx->value[key];
         }
 }
@@ -1156,7 +1815,7 @@ void sche_unyielding(int unyielding)
 
         LTG_ASSERT(sche);
         LTG_ASSERT(sche->running_task != -1);
-        taskctx = &sche->tasks[sche->running_task];
+        taskctx = sche_taskctx(sche, sche->running_task);
 
         if (unyielding) {
                 LTG_ASSERT(taskctx->pre_yield == 0);
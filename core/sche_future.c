@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+
+#define DBG_SUBSYS S_LTG_CORE
+
+#include "ltg_utils.h"
+#include "ltg_core.h"
+
+/**
+ * futures let one task wait for several events, sche_yield pairs with a
+ * single sche_task_post. the waiter links a sche_future_wait_t on its stack
+ * to the futures, the completion reaching the wanted count posts it once.
+ *
+ * futures are completed on the core of the waiter (rpc_table callbacks,
+ * core_ring replies), so there is no locking here.
+ */
+
+void sche_future_init(sche_future_t *future)
+{
+        future->done = 0;
+        future->retval = 0;
+        future->wait = NULL;
+}
+
+static int __sche_future_ready(const sche_future_wait_t *wait)
+{
+        return wait->done >= wait->need || wait->fail > wait->fail_max;
+}
+
+void IO_FUNC sche_future_set(sche_future_t *future, int retval)
+{
+        sche_future_wait_t *wait;
+
+        LTG_ASSERT(future->done == 0);
+
+        future->done = 1;
+        future->retval = retval;
+
+        wait = future->wait;
+        if (wait == NULL)
+                return;
+
+        if (likely(retval == 0)) {
+                wait->done++;
+        } else {
+                if (wait->fail == 0)
+                        wait->retval = retval;
+                wait->fail++;
+        }
+
+        if (wait->posted == 0 && __sche_future_ready(wait)) {
+                wait->posted = 1;
+                sche_task_post(&wait->task, 0, NULL);
+        }
+}
+
+/**
+ * wait until k of count futures succeeded, k == count is wait all and
+ * k == 1 wait any. the deadline is the one of the operations behind the
+ * futures, see sche_task_deadline_set.
+ *
+ * @return 0, or the first failure once k successes became impossible
+ */
+int IO_FUNC sche_future_wait(const char *name, sche_future_t **futures,
+                             int count, int k)
+{
+        int ret, i;
+        sche_future_wait_t wait;
+
+        LTG_ASSERT(count > 0 && count <= SCHE_FUTURE_MAX);
+        LTG_ASSERT(k > 0 && k <= count);
+
+        wait.need = k;
+        wait.fail_max = count - k;
+        wait.done = 0;
+        wait.fail = 0;
+        wait.retval = 0;
+        wait.posted = 0;
+
+        for (i = 0; i < count; i++) {
+                if (futures[i]->done) {
+                        if (futures[i]->retval == 0) {
+                                wait.done++;
+                        } else {
+                                if (wait.fail == 0)
+                                        wait.retval = futures[i]->retval;
+                                wait.fail++;
+                        }
+                }
+        }
+
+        if (!__sche_future_ready(&wait)) {
+                for (i = 0; i < count; i++) {
+                        if (!futures[i]->done) {
+                                LTG_ASSERT(futures[i]->wait == NULL);
+                                futures[i]->wait = &wait;
+                        }
+                }
+
+                wait.task = sche_task_get();
+                ret = sche_yield(name, NULL, NULL);
+                LTG_ASSERT(ret == 0);
+
+                // the rest complete without us
+                for (i = 0; i < count; i++) {
+                        futures[i]->wait = NULL;
+                }
+        }
+
+        if (unlikely(wait.done < wait.need)) {
+                ret = wait.retval;
+                GOTO(err_ret, ret);
+        }
+
+        return 0;
+err_ret:
+        return ret;
+}
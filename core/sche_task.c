@@ -20,10 +20,13 @@ typedef struct {
         struct list_head hook;
         char name[MAX_NAME_LEN];
         int group;
+        int flag;
         func_t func;
         void *arg;
 } wait_task_t;
 
+static const uint32_t __stack_size__[SCHE_STACK_MAX] = SCHE_STACK_SIZE;
+
 extern sche_t **__sche_array__;
 
 #ifdef NEW_SCHED
@@ -72,13 +75,15 @@ inline task_t sche_task_get()
 
         LTG_ASSERT(sche);
         LTG_ASSERT(sche->running_task != -1);
-        taskctx = &sche->tasks[sche->running_task];
+        taskctx = sche_taskctx(sche, sche->running_task);
         LTG_ASSERT(taskctx->state == TASK_STAT_RUNNING);
         LTG_ASSERT(taskctx->pre_yield == 0);
         taskctx->pre_yield = 1;
 
         sche_fingerprint_new(sche, taskctx);
 
+        static_assert(TASK_MAX <= INT16_MAX + 1, "task_t.taskid");
+
         taskid.scheid = sche->id;
         taskid.taskid = sche->running_task;
         taskid.fingerprint = taskctx->fingerprint;
@@ -93,7 +98,7 @@ inline int sche_task_get1(sche_t *sche, task_t *taskid)
 
         LTG_ASSERT(sche);
         LTG_ASSERT(sche->running_task != -1);
-        taskctx = &sche->tasks[sche->running_task];
+        taskctx = sche_taskctx(sche, sche->running_task);
         LTG_ASSERT(taskctx->state == TASK_STAT_RUNNING);
 
         if (unlikely(taskctx->pre_yield)) {
@@ -120,7 +125,7 @@ static void __sche_task_sleep(task_t *task)
         taskctx_t *taskctx;
 
         LTG_ASSERT(sche);
-        taskctx = &sche->tasks[task->taskid];
+        taskctx = sche_taskctx(sche, task->taskid);
         LTG_ASSERT(taskctx->sleeping == 0);
         taskctx->sleeping = 1;
         taskctx->sleep = 1;
@@ -132,7 +137,7 @@ static void __sche_task_wakeup(task_t *task)
         taskctx_t *taskctx;
 
         LTG_ASSERT(sche);
-        taskctx = &sche->tasks[task->taskid];
+        taskctx = sche_taskctx(sche, task->taskid);
         LTG_ASSERT(taskctx->sleeping == 1);
         taskctx->sleeping = 0;
 }
@@ -144,7 +149,7 @@ void sche_task_reset()
 
         LTG_ASSERT(sche);
         LTG_ASSERT(sche->running_task != -1);
-        taskctx = &sche->tasks[sche->running_task];
+        taskctx = sche_taskctx(sche, sche->running_task);
         LTG_ASSERT(taskctx->state == TASK_STAT_RUNNING);
         //LTG_ASSERT(taskctx->pre_yield == 1);
         taskctx->pre_yield = 0;
@@ -181,7 +186,8 @@ int sche_task_sleep(const char *name, suseconds_t usec)
         if (likely(sche_running())) {
                 LTG_ASSERT(usec < 180 * 1000 * 1000);
 
-                if (sche->eventfd == -1) {
+                // interrupt mode timers expire in the timer thread
+                if (sche->eventfd == -1 || sche->hybrid) {
                         slp = slab_stream_alloc(sizeof(*slp));
                 } else {
                         slp = slab_stream_alloc_glob(sizeof(*slp));
@@ -241,52 +247,122 @@ static void __sche_task_post_remote(sche_t *sche, const task_t *task,
         return;
 }
 
-static void IO_FUNC __sche_task_post(sche_t *sche, reply_queue_t *reply_queue,
-                              const task_t *task, int retval, ltgbuf_t *buf)
+static reply_ring_t *__sche_reply_ring_get(sche_t *sche, sche_t *self)
 {
         int ret;
-        ltgbuf_t *mem = slab_stream_alloc(PAGE_SIZE);
-        reply_t *reply;
-        
-        LTG_ASSERT(task->scheid >= 0 && task->scheid <= SCHEDULE_MAX);
-        LTG_ASSERT(task->taskid >= 0 && task->taskid < TASK_MAX);
-        LTG_ASSERT(task->fingerprint);
+        reply_ring_t *ring;
 
-        (void) sche;
+        ring = sche->reply_ring[self->id];
+        if (likely(ring)) {
+                return ring;
+        }
 
-        if (unlikely(reply_queue->count == reply_queue->max)) {
-                if (unlikely(reply_queue->count + REPLY_QUEUE_STEP > REPLY_QUEUE_MAX)) {
-                        ret = ENOSPC;
-                        GOTO(err_ret, ret);
-                }
+        // polled by sche, place it on the consumer node
+        ret = ltg_malloc_node((void **)&ring, sizeof(*ring), sche->node);
+        if (unlikely(ret))
+                return NULL;
 
-                DBUG("new reply_queue array %u\n", reply_queue->max + REPLY_QUEUE_STEP);
+        memset(ring, 0x0, sizeof(*ring));
+        ring->producer = self->id;
 
-                // @note 会导致buffer.list失效, 所以reply.buffer需要是指针类型
-                ret = ltg_realloc((void **)&reply_queue->replys,
-                               sizeof(*reply) * reply_queue->max,
-                               sizeof(*reply) * (reply_queue->max + REPLY_QUEUE_STEP));
-                if (unlikely(ret))
-                        UNIMPLEMENTED(__DUMP__);
+        ret = ltg_spin_lock(&sche->reply_remote_lock);
+        if (unlikely(ret))
+                UNIMPLEMENTED(__DUMP__);
+
+        LTG_ASSERT(sche->reply_ring_count < SCHEDULE_MAX);
+        sche->reply_ring_array[sche->reply_ring_count] = ring;
+        __atomic_store_n(&sche->reply_ring_count, sche->reply_ring_count + 1,
+                         __ATOMIC_RELEASE);
+
+        ltg_spin_unlock(&sche->reply_remote_lock);
+
+        // only the producer itself reads this slot
+        sche->reply_ring[self->id] = ring;
+
+        DINFO("%s[%u] -> %s[%u] reply ring created\n", self->name, self->id,
+              sche->name, sche->id);
+
+        return ring;
+}
+
+static int IO_FUNC __sche_task_post_ring(sche_t *sche, sche_t *self,
+                                         const task_t *task, int retval,
+                                         ltgbuf_t *buf)
+{
+        int ret;
+        uint32_t head, tail;
+        reply_ring_t *ring;
+        reply_remote_t *reply;
 
-                reply_queue->max += REPLY_QUEUE_STEP;
+        LTG_ASSERT(task->taskid >= 0 && task->taskid < TASK_MAX);
+        LTG_ASSERT(task->fingerprint);
+
+        ring = __sche_reply_ring_get(sche, self);
+        if (unlikely(ring == NULL)) {
+                ret = ENOMEM;
+                GOTO(err_ret, ret);
         }
 
-        reply = &reply_queue->replys[reply_queue->count];
+        head = ring->head;
+        tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (unlikely(head - tail >= REPLY_RING_SIZE)) {
+                ret = ENOSPC;
+                goto err_ret;
+        }
+
+        reply = &ring->entry[head % REPLY_RING_SIZE];
         reply->task = *task;
         reply->retval = retval;
-        reply->buf = mem;
-        ltgbuf_init(reply->buf, 0);
+        ltgbuf_init(&reply->buf, 0);
         if (buf && buf->len) {
-                ltgbuf_merge(reply->buf, buf);
+                ltgbuf_merge(&reply->buf, buf);
         }
 
-        reply_queue->count++;
+        __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
 
-        return;
+        return 0;
 err_ret:
-        UNIMPLEMENTED(__DUMP__);
-        return;
+        return ret;
+}
+
+/**
+ * same core wakeup, the reply is kept in the waiting taskctx and the task is
+ * linked to sche->reply_local by taskctx->hook, it will be moved to runable
+ * by sche_run. the task may still be running here (posted before yield).
+ */
+static void IO_FUNC __sche_task_post(sche_t *sche, const task_t *task,
+                                     int retval, ltgbuf_t *buf)
+{
+        taskctx_t *taskctx;
+
+        LTG_ASSERT(task->scheid >= 0 && task->scheid <= SCHEDULE_MAX);
+        LTG_ASSERT(task->taskid >= 0 && task->taskid < TASK_MAX);
+        LTG_ASSERT(task->fingerprint);
+
+        taskctx = sche_taskctx(sche, task->taskid);
+        if (unlikely(task->fingerprint != taskctx->fingerprint)) {
+                DERROR("post task[%u] %s already destroyed\n", taskctx->id,
+                       taskctx->name);
+                if (buf && buf->len) {
+                        ltgbuf_free(buf);
+                }
+
+                return;
+        }
+
+        LTG_ASSERT(taskctx->state == TASK_STAT_SUSPEND
+                   || taskctx->state == TASK_STAT_RUNNING);
+        LTG_ASSERT(taskctx->posted == 0);
+        LTG_ASSERT(retval <= INT32_MAX);
+
+        taskctx->posted = 1;
+        taskctx->retval = retval;
+        ltgbuf_init(&taskctx->buf, 0);
+        if (buf && buf->len) {
+                ltgbuf_merge(&taskctx->buf, buf);
+        }
+
+        count_list_add_tail(&taskctx->hook, &sche->reply_local);
 }
 
 void IO_FUNC sche_task_post(const task_t *task, int retval, ltgbuf_t *buf)
@@ -294,11 +370,17 @@ void IO_FUNC sche_task_post(const task_t *task, int retval, ltgbuf_t *buf)
         sche_t *sche = __sche_array__[task->scheid];
 
         if (likely(sche == sche_self())) {
-                __sche_task_post(sche, &sche->reply_local, task, retval, buf);
+                __sche_task_post(sche, task, retval, buf);
 
                 //sche_post(sche);
         } else {
-                __sche_task_post_remote(sche, task, retval, buf);
+                sche_t *self = sche_self();
+                if (unlikely(self == NULL
+                             || __sche_task_post_ring(sche, self, task,
+                                                      retval, buf))) {
+                        __sche_task_post_remote(sche, task, retval, buf);
+                }
+
                 sche_post(sche);
         }
 }
@@ -309,19 +391,94 @@ inline void sche_task_setname(const char *name)
         taskctx_t *taskctx;
 
         LTG_ASSERT(sche->running_task != -1);
-        taskctx = &sche->tasks[sche->running_task];
+        taskctx = sche_taskctx(sche, sche->running_task);
         LTG_ASSERT(taskctx->state == TASK_STAT_RUNNING);
         strcpy(taskctx->name, name);
 }
 
-static int IO_FUNC __sche_task_hasfree(sche_t *sche)
+static taskctx_t *__sche_task_current(sche_t **_sche)
+{
+        sche_t *sche = sche_self();
+
+        if (unlikely(!(sche && sche->running_task != -1)))
+                return NULL;
+
+        *_sche = sche;
+        return sche_taskctx(sche, sche->running_task);
+}
+
+void sche_task_deadline_abs(uint64_t deadline)
 {
-        if (unlikely((TASK_MAX - sche->free_task.count) >= TASK_MAX / 2))
+        sche_t *sche;
+        taskctx_t *taskctx;
+
+        taskctx = __sche_task_current(&sche);
+        if (unlikely(taskctx == NULL))
+                return;
+
+        if (deadline == 0) {
+                taskctx->deadline = 0;
+        } else if (taskctx->deadline == 0 || deadline < taskctx->deadline) {
+                taskctx->deadline = deadline;
+        }
+}
+
+void sche_task_deadline_set(uint64_t usec)
+{
+        sche_t *sche;
+        taskctx_t *taskctx;
+
+        taskctx = __sche_task_current(&sche);
+        if (unlikely(taskctx == NULL))
+                return;
+
+        sche_task_deadline_abs(usec ? sche_deadline(sche, usec) : 0);
+}
+
+int64_t IO_FUNC sche_task_deadline_left()
+{
+        sche_t *sche;
+        taskctx_t *taskctx;
+        uint64_t now;
+
+        taskctx = __sche_task_current(&sche);
+        if (likely(taskctx == NULL || taskctx->deadline == 0))
+                return -1;
+
+        now = get_rdtsc();
+        if (now >= taskctx->deadline)
                 return 0;
-        else
+
+        return (taskctx->deadline - now) / (sche->hz / (1000 * 1000));
+}
+
+int IO_FUNC sche_task_expired()
+{
+        return sche_task_deadline_left() == 0;
+}
+
+static int IO_FUNC __sche_task_hasfree(sche_t *sche)
+{
+        int ret;
+
+        if (likely(sche->free_task.count))
                 return 1;
+
+        ret = sche_taskctx_grow(sche);
+        if (unlikely(ret))
+                return 0;
+
+        return 1;
 }
 
+static taskctx_t *__sche_task_start(sche_t *sche, const char *name,
+                                    func_t func, void *arg, int group,
+                                    int stack_class);
+
+/*
+ * start the oldest parked task, it stays first in wait_task if there is
+ * still no taskctx or stack.
+ */
 static void __sche_wait_task_resume(sche_t *sche)
 {
         wait_task_t *wait_task;
@@ -330,17 +487,16 @@ static void __sche_wait_task_resume(sche_t *sche)
                 return;
         }
 
-        if (!__sche_task_hasfree(sche)) {
+        wait_task = (void *)sche->wait_task.list.next;
+        if (__sche_task_start(sche, wait_task->name, wait_task->func,
+                              wait_task->arg, wait_task->group,
+                              wait_task->flag) == NULL) {
                 return;
         }
 
-        wait_task = (void *)sche->wait_task.list.next;
-        count_list_del(&wait_task->hook, &sche->wait_task);
-
         DBUG("resume wait task %s\n", wait_task->name);
 
-        sche_task_new(wait_task->name, wait_task->func, wait_task->arg,
-                      wait_task->group);
+        count_list_del(&wait_task->hook, &sche->wait_task);
         ltg_free((void **)&wait_task);
 }
 
@@ -395,7 +551,8 @@ static void IO_FUNC __sche_trampoline(taskctx_t *taskctx)
         taskctx->state = TASK_STAT_FREE;
         LTG_ASSERT(sche->task_count >= 0);
         list_del(&taskctx->running_hook);
-        /* list_add better than list_add_tail here, otherwise statck will malloc for each task */
+        /* list_add better than list_add_tail here, reuse the cache hot taskctx,
+         * the stack is given back by sche_stack_put after we swap out */
         count_list_add(&taskctx->running_hook, &sche->free_task);
 
 #ifdef NEW_SCHED
@@ -407,7 +564,7 @@ static void IO_FUNC __sche_trampoline(taskctx_t *taskctx)
 static void IO_FUNC __sche_makecontext(sche_t *sche, taskctx_t *taskctx)
 {
         (void) sche;
-        char *stack_top = (char *)taskctx->stack +  DEFAULT_STACK_SIZE;
+        char *stack_top = (char *)taskctx->stack +  taskctx->stack_size;
         void **stack = NULL;
         stack = (void **)stack_top;
 
@@ -424,14 +581,15 @@ static void IO_FUNC __sche_makecontext(sche_t *sche, taskctx_t *taskctx)
         getcontext(&(taskctx->ctx));
 
         taskctx->ctx.uc_stack.ss_sp = taskctx->stack;
-        taskctx->ctx.uc_stack.ss_size = DEFAULT_STACK_SIZE;
+        taskctx->ctx.uc_stack.ss_size = taskctx->stack_size;
         taskctx->ctx.uc_stack.ss_flags = 0;
         taskctx->ctx.uc_link = &(taskctx->main);
         makecontext(&(taskctx->ctx), (void (*)(void))(__sche_trampoline), 1, taskctx);
 }
 #endif
 
-static int __sche_wait_task(const char *name, func_t func, void *arg, int group)
+static int __sche_wait_task(const char *name, func_t func, void *arg, int group,
+                            int flag)
 {
         int ret;
         wait_task_t *wait_task;
@@ -446,6 +604,7 @@ static int __sche_wait_task(const char *name, func_t func, void *arg, int group)
         wait_task->arg = arg;
         wait_task->func = func;
         wait_task->group = group;
+        wait_task->flag = flag;
         strcpy(wait_task->name, name);
 
         count_list_add_tail(&wait_task->hook, &sche->wait_task);
@@ -455,76 +614,450 @@ err_ret:
         return ret;
 }
 
-static void *__sche_task_new(sche_t *sche)
+int sche_taskctx_grow(sche_t *sche)
+{
+        int ret, i;
+        taskctx_t *taskctx;
+
+        if (unlikely(sche->size + TASK_CHUNK > TASK_MAX)) {
+                ret = ENOSPC;
+                GOTO(err_ret, ret);
+        }
+
+        ret = ltg_malloc((void **)&taskctx, sizeof(*taskctx) * TASK_CHUNK);
+        if (unlikely(ret))
+                GOTO(err_ret, ret);
+
+        memset(taskctx, 0x0, sizeof(*taskctx) * TASK_CHUNK);
+
+        for (i = 0; i < TASK_CHUNK; ++i) {
+                taskctx[i].id = sche->size + i;
+                taskctx[i].stack = NULL;
+                taskctx[i].state = TASK_STAT_FREE;
+                count_list_add_tail(&taskctx[i].running_hook, &sche->free_task);
+        }
+
+        sche->tasks[sche->size / TASK_CHUNK] = taskctx;
+        sche->size += TASK_CHUNK;
+
+        DINFO("%s[%u] task %u\n", sche->name, sche->id, sche->size);
+
+        return 0;
+err_ret:
+        return ret;
+}
+
+void sche_stack_init(sche_t *sche)
+{
+        sche_stack_pool_t *pool;
+
+        for (int i = 0; i < SCHE_STACK_MAX; i++) {
+                pool = &sche->stack_pool[i];
+                INIT_LIST_HEAD(&pool->page_list);
+                pool->page_count = 0;
+                pool->empty = 0;
+                pool->used = 0;
+                pool->stack_size = __stack_size__[i];
+                LTG_ASSERT(STACK_PAGE_SIZE % pool->stack_size == 0);
+                LTG_ASSERT(pool->stack_size > KEEP_STACK_SIZE);
+        }
+}
+
+static int __sche_stack_page_new(sche_t *sche, int stack_class)
+{
+        int ret, i;
+        sche_stack_page_t *page;
+        sche_stack_pool_t *pool = &sche->stack_pool[stack_class];
+
+        ret = ltg_malloc((void **)&page, sizeof(*page));
+        if (unlikely(ret))
+                GOTO(err_ret, ret);
+
+        if (core_self() && ltgconf_global.daemon && ENABLE_HUGEPAGE) {
+                uint32_t size = STACK_PAGE_SIZE;
+                ret = hugepage_getfree((void **)&page->addr, &size);
+                if (unlikely(ret))
+                        GOTO(err_free, ret);
+
+                LTG_ASSERT(size == STACK_PAGE_SIZE);
+                page->hugepage = 1;
+        } else {
+                ret = ltg_malloc((void **)&page->addr, STACK_PAGE_SIZE);
+                if (unlikely(ret))
+                        GOTO(err_free, ret);
+
+                page->hugepage = 0;
+        }
+
+        page->stack_class = stack_class;
+        page->used = 0;
+        page->total = STACK_PAGE_SIZE / pool->stack_size;
+        INIT_LIST_HEAD(&page->free);
+
+        for (i = 0; i < page->total; i++) {
+                list_add_tail((struct list_head *)(page->addr + pool->stack_size * i),
+                              &page->free);
+        }
+
+        list_add(&page->hook, &pool->page_list);
+        pool->page_count++;
+        pool->empty++;
+
+        DINFO("%s[%u] stack class %u page %p new, count %u\n", sche->name,
+              sche->id, stack_class, page->addr, pool->page_count);
+
+        return 0;
+err_free:
+        ltg_free((void **)&page);
+err_ret:
+        return ret;
+}
+
+static void __sche_stack_page_free(sche_t *sche, sche_stack_page_t *page)
+{
+        sche_stack_pool_t *pool = &sche->stack_pool[page->stack_class];
+
+        LTG_ASSERT(page->used == 0);
+
+        DINFO("%s[%u] stack class %u page %p free, count %u\n", sche->name,
+              sche->id, page->stack_class, page->addr, pool->page_count);
+
+        list_del(&page->hook);
+        pool->page_count--;
+
+        if (page->hugepage) {
+                hugepage_putfree(page->addr, STACK_PAGE_SIZE);
+        } else {
+                ltg_free((void **)&page->addr);
+        }
+
+        ltg_free((void **)&page);
+}
+
+static sche_stack_prof_t *__sche_stack_prof_get(sche_t *sche, func_t func,
+                                                const char *name, int create)
 {
         int ret;
-        void *stack, *vaddr;
+        uint32_t i, idx;
+        sche_stack_prof_t *prof;
 
-        if (core_self() && ltgconf_global.daemon && ENABLE_HUGEPAGE){
-                if (sche->task_hpage == NULL) {
-                        uint32_t size = HUGEPAGE_SIZE;
-                        int ret = hugepage_getfree((void **)&vaddr, &size);
-                        LTG_ASSERT(ret == 0);
-                        LTG_ASSERT(size == HUGEPAGE_SIZE);
+        if (unlikely(sche->stack_prof == NULL)) {
+                if (!create)
+                        return NULL;
 
-                        sche->task_hpage = vaddr;
-                        sche->task_hpage_offset = 0;
+                ret = ltg_malloc((void **)&sche->stack_prof,
+                                 sizeof(*prof) * SCHE_STACK_PROF_MAX);
+                if (unlikely(ret))
+                        return NULL;
+
+                memset(sche->stack_prof, 0x0, sizeof(*prof) * SCHE_STACK_PROF_MAX);
+        }
 
-                        DINFO("new task hugepage %p offset %x, new\n",
-                              sche->task_hpage, sche->task_hpage_offset);
+        // one name often covers many handlers ("corenet"), key on func
+        idx = hash_mem(&func, sizeof(func));
+        for (i = 0; i < SCHE_STACK_PROF_MAX; i++) {
+                prof = &sche->stack_prof[(idx + i) % SCHE_STACK_PROF_MAX];
+                if (prof->func == NULL) {
+                        if (!create)
+                                return NULL;
+
+                        prof->func = func;
+                        strncpy(prof->name, name, MAX_NAME_LEN - 1);
+                        prof->stack_class = -1;
+                        return prof;
                 }
 
-                stack =  sche->task_hpage + sche->task_hpage_offset;
-                sche->task_hpage_offset += DEFAULT_STACK_SIZE;
-                if (sche->task_hpage_offset >= 2 * 1024 * 1024){
-                        DBUG("new task hugepage %p offset %x, removed\n",
-                              sche->task_hpage, sche->task_hpage_offset);
+                if (prof->func == func)
+                        return prof;
+        }
 
-                        sche->task_hpage = NULL;
-                        sche->task_hpage_offset = 0;
-                } else {
-                        DBUG("new task hugepage %p offset %x, reuse\n",
-                              sche->task_hpage, sche->task_hpage_offset);
+        // table full, not profiled
+        return NULL;
+}
+
+static void __sche_stack_canary(taskctx_t *taskctx)
+{
+        uint64_t *pos = taskctx->stack + KEEP_STACK_SIZE;
+        uint64_t *end = taskctx->stack + KEEP_STACK_SIZE + SCHE_STACK_CANARY_SIZE;
+
+        while (pos < end) {
+                *pos++ = SCHE_STACK_CANARY;
+        }
+}
+
+static void __sche_stack_canary_check(sche_t *sche, taskctx_t *taskctx)
+{
+        uint64_t *pos = taskctx->stack + KEEP_STACK_SIZE;
+        uint64_t *end = taskctx->stack + KEEP_STACK_SIZE + SCHE_STACK_CANARY_SIZE;
+
+        while (pos < end) {
+                if (unlikely(*pos++ != SCHE_STACK_CANARY)) {
+                        DERROR("%s[%u] task %s overflowed stack class %d size %u\n",
+                               sche->name, sche->id, taskctx->name,
+                               taskctx->stack_class, taskctx->stack_size);
+                        LTG_ASSERT(0);
                 }
-        } else {
-                ret = ltg_malloc((void **)&stack, DEFAULT_STACK_SIZE);
-                LTG_ASSERT(ret == 0);
+        }
+}
+
+/*
+ * paint every start until SCHE_STACK_PROF_SAMPLE depths are seen, then one
+ * in SCHE_STACK_PROF_EVERY, the memset costs as much as a short task
+ */
+static void __sche_stack_paint(sche_t *sche, taskctx_t *taskctx)
+{
+        sche_stack_prof_t *prof;
+        uint64_t *pos = taskctx->stack + KEEP_STACK_SIZE;
+        uint64_t *end = taskctx->stack + taskctx->stack_size;
+
+        prof = __sche_stack_prof_get(sche, taskctx->func, taskctx->name, 1);
+        if (unlikely(prof == NULL))
+                return;
+
+        prof->start++;
+        if (prof->count >= SCHE_STACK_PROF_SAMPLE
+            && prof->start % SCHE_STACK_PROF_EVERY)
+                return;
+
+        // keep the canary
+        if (taskctx->stack_class == SCHE_STACK_SMALL)
+                pos = taskctx->stack + KEEP_STACK_SIZE + SCHE_STACK_CANARY_SIZE;
+
+        while (pos < end) {
+                *pos++ = SCHE_STACK_PAINT;
+        }
+
+        taskctx->stack_paint = 1;
+}
+
+static void __sche_stack_prof(sche_t *sche, taskctx_t *taskctx)
+{
+        int i;
+        uint32_t depth, size;
+        sche_stack_prof_t *prof;
+        uint64_t *pos = taskctx->stack + KEEP_STACK_SIZE;
+        uint64_t *end = taskctx->stack + taskctx->stack_size;
+
+        if (taskctx->stack_class == SCHE_STACK_SMALL)
+                pos = taskctx->stack + KEEP_STACK_SIZE + SCHE_STACK_CANARY_SIZE;
+
+        // stack grows down, the lowest overwritten word is the high water mark
+        while (pos < end && *pos == SCHE_STACK_PAINT) {
+                pos++;
+        }
+
+        depth = (void *)end - (void *)pos;
+
+        prof = __sche_stack_prof_get(sche, taskctx->func, taskctx->name, 1);
+        if (unlikely(prof == NULL))
+                return;
+
+        prof->count++;
+        if (depth > prof->max)
+                prof->max = depth;
+
+        for (i = 0; i < SCHE_STACK_PROF_HIST - 1; i++) {
+                if (depth <= (1024U << i))
+                        break;
+        }
+
+        prof->hist[i]++;
+
+        if (prof->count < SCHE_STACK_PROF_SAMPLE)
+                return;
+
+        // max only grows, so the picked class never shrinks
+        for (i = 0; i < SCHE_STACK_LARGE; i++) {
+                size = __stack_size__[i];
+                if (prof->max * 2 + KEEP_STACK_SIZE <= size)
+                        break;
+        }
+
+        if (prof->stack_class != i) {
+                DINFO("%s[%u] task %s stack max %u, class %d -> %d\n",
+                      sche->name, sche->id, prof->name, prof->max,
+                      prof->stack_class, i);
+                prof->stack_class = i;
+        }
+}
+
+static int __sche_stack_class(sche_t *sche, func_t func)
+{
+        sche_stack_prof_t *prof;
+
+        prof = __sche_stack_prof_get(sche, func, NULL, 0);
+        if (prof == NULL || prof->stack_class == -1)
+                return SCHE_STACK_DEFAULT;
+
+        return prof->stack_class;
+}
+
+void sche_stack_prof_dump(sche_t *sche)
+{
+        int i, j, len;
+        char hist[MAX_INFO_LEN];
+        sche_stack_prof_t *prof;
+
+        if (sche->stack_prof == NULL)
+                return;
+
+        for (i = 0; i < SCHE_STACK_PROF_MAX; i++) {
+                prof = &sche->stack_prof[i];
+                if (prof->func == NULL)
+                        continue;
+
+                len = 0;
+                for (j = 0; j < SCHE_STACK_PROF_HIST; j++) {
+                        len += snprintf(hist + len, MAX_INFO_LEN - len, "%s%uk:%ju",
+                                        j ? " " : "", 1U << j, prof->hist[j]);
+                }
+
+                DINFO("%s[%u] stack %s %p count %ju max %u class %d hist %s\n",
+                      sche->name, sche->id, prof->name, prof->func, prof->count,
+                      prof->max, prof->stack_class, hist);
+        }
+}
+
+/*
+ * @return ENOMEM if a new stack page can not be had, the caller parks the
+ * task on wait_task
+ */
+static int IO_FUNC __sche_stack_get(sche_t *sche, taskctx_t *taskctx, int stack_class)
+{
+        int ret;
+        struct list_head *stack;
+        sche_stack_page_t *page;
+        sche_stack_pool_t *pool = &sche->stack_pool[stack_class];
+
+        page = list_empty(&pool->page_list) ? NULL
+                : list_entry(pool->page_list.next, sche_stack_page_t, hook);
+        if (unlikely(page == NULL || list_empty(&page->free))) {
+                ret = __sche_stack_page_new(sche, stack_class);
+                if (unlikely(ret)) {
+                        DWARN("%s[%u] stack class %u page, count %u, %s\n",
+                              sche->name, sche->id, stack_class,
+                              pool->page_count, strerror(ret));
+                        return ret;
+                }
+
+                page = list_entry(pool->page_list.next, sche_stack_page_t, hook);
+        }
+
+        stack = page->free.next;
+        list_del(stack);
+
+        if (page->used == 0)
+                pool->empty--;
+
+        page->used++;
+        pool->used++;
+
+        if (list_empty(&page->free)) {
+                list_move_tail(&page->hook, &pool->page_list);
         }
 
         memset(stack, 0x0, KEEP_STACK_SIZE);
 
-        return stack;
+        taskctx->stack = stack;
+        taskctx->stack_page = page;
+        taskctx->stack_size = pool->stack_size;
+        taskctx->stack_class = stack_class;
+
+        if (stack_class == SCHE_STACK_SMALL) {
+                __sche_stack_canary(taskctx);
+        }
+
+        return 0;
 }
 
-int IO_FUNC sche_task_new(const char *name, func_t func, void *arg, int _group)
+/**
+ * called by the sche after the task returned, one idle page per class is
+ * kept to avoid hugepage alloc/free on each burst.
+ */
+void IO_FUNC sche_stack_put(sche_t *sche, taskctx_t *taskctx)
 {
-        int ret, group;
-        sche_t *sche = sche_self();
-        taskctx_t *taskctx;
+        sche_stack_page_t *page = taskctx->stack_page;
+        sche_stack_pool_t *pool = &sche->stack_pool[page->stack_class];
 
-#if 1
-        group = _group != -1 ? _group : (SCHE_GROUP_MAX - 1);
-#else
-        (void) _group;
-        group = 0;
-#endif
+        LTG_ASSERT(taskctx->state == TASK_STAT_FREE);
 
-        DBUG("create task %s group %u\n", name, group);
+        if (taskctx->stack_class == SCHE_STACK_SMALL) {
+                __sche_stack_canary_check(sche, taskctx);
+        }
 
-        LTG_ASSERT(group >= SCHE_GROUP0 && group < SCHE_GROUP_MAX);
-        LTG_ASSERT(sche);
+        if (unlikely(taskctx->stack_paint)) {
+                __sche_stack_prof(sche, taskctx);
+                taskctx->stack_paint = 0;
+        }
 
-        if (unlikely(!__sche_task_hasfree(sche))) {
-                ret = __sche_wait_task(name, func, arg, group);
-                if (unlikely(ret))
-                        UNIMPLEMENTED(__DUMP__);
+        list_add((struct list_head *)taskctx->stack, &page->free);
+        page->used--;
+        pool->used--;
+
+        taskctx->stack = NULL;
+        taskctx->stack_page = NULL;
+
+        // tasks parked while no stack page could be had
+        if (unlikely(sche->wait_task.count)) {
+                __sche_wait_task_resume(sche);
         }
 
-	taskctx = list_entry(sche->free_task.list.next, taskctx_t, running_hook);
-	count_list_del(&taskctx->running_hook, &sche->free_task);
-	if (unlikely(taskctx->stack == NULL)) {
-                taskctx->stack = __sche_task_new(sche);
-	}
+        if (page->used == 0) {
+                if (pool->empty) {
+                        __sche_stack_page_free(sche, page);
+                } else {
+                        pool->empty++;
+                        list_move(&page->hook, &pool->page_list);
+                }
+        } else if (page->used == page->total - 1) {
+                list_move(&page->hook, &pool->page_list);
+        }
+}
+
+void sche_stack_stat(sche_t *sche, int stack_class, int *page, uint64_t *used)
+{
+        sche_stack_pool_t *pool = &sche->stack_pool[stack_class];
+
+        *page = pool->page_count;
+        *used = pool->used;
+}
+
+static int __sche_task_migrate(sche_t *sche, const char *name, func_t func,
+                               void *arg, int group, int stack_class)
+{
+        steal_task_t task;
+
+        if (unlikely(strlen(name) + 1 > SCHE_NAME_LEN))
+                return ENAMETOOLONG;
+
+        task.func = func;
+        task.arg = arg;
+        task.group = group;
+        task.stack_class = stack_class;
+        strcpy(task.name, name);
+
+        return sche_steal_push(sche, &task);
+}
+
+/*
+ * take a free taskctx and queue it runnable, the caller sets ctime and
+ * makes the context.
+ * @return NULL if no stack, the taskctx stays free
+ */
+static taskctx_t IO_FUNC *__sche_task_init(sche_t *sche, const char *name,
+                                           func_t func, void *arg, int group,
+                                           int stack_class)
+{
+        int ret;
+        taskctx_t *taskctx;
+
+        taskctx = list_entry(sche->free_task.list.next, taskctx_t, running_hook);
+        LTG_ASSERT(taskctx->stack == NULL);
+        ret = __sche_stack_get(sche, taskctx, stack_class);
+        if (unlikely(ret))
+                return NULL;
+
+        count_list_del(&taskctx->running_hook, &sche->free_task);
 
         DBUG("%s\n", name);
         strcpy(taskctx->name, name);
@@ -534,11 +1067,20 @@ int IO_FUNC sche_task_new(const char *name, func_t func, void *arg, int _group)
         taskctx->step = 0;
         taskctx->pre_yield = 0;
         taskctx->sleeping = 0;
+        taskctx->posted = 0;
         taskctx->wait_begin = 0;
         taskctx->wait_tmo = 0;
+        taskctx->deadline = 0;
+        taskctx->cpu_time = 0;
         taskctx->sleep = 0;
         taskctx->sche = sche;
         taskctx->group = group;
+        taskctx->stack_paint = 0;
+
+        if (unlikely(ltgconf_global.stack_profile)) {
+                __sche_stack_paint(sche, taskctx);
+        }
+
         sche->task_count++;
 
         list_add_tail(&taskctx->running_hook, &sche->running_task_list);
@@ -549,20 +1091,173 @@ int IO_FUNC sche_task_new(const char *name, func_t func, void *arg, int _group)
 #endif
 
         DBUG("new task[%d] %s count:%d\n", taskctx->id, name, sche->task_count);
+        TRACE(TRACE_TASK_CREATE, taskctx->id, group, name);
 
         sche_fingerprint_new(sche, taskctx);
+        count_list_add_tail(&taskctx->hook, &sche->runable[taskctx->group]);
+
+        return taskctx;
+}
+
+/*
+ * @return NULL if the pool is at TASK_MAX or no stack page can be had
+ */
+static taskctx_t *__sche_task_start(sche_t *sche, const char *name,
+                                    func_t func, void *arg, int group,
+                                    int stack_class)
+{
+        taskctx_t *taskctx;
+
+        if (unlikely(!__sche_task_hasfree(sche)))
+                return NULL;
+
+        taskctx = __sche_task_init(sche, name, func, arg, group, stack_class);
+        if (unlikely(taskctx == NULL))
+                return NULL;
+
 #if SCHEDULE_TASKCTX_RUNTIME
         taskctx->ctime = get_rdtsc();
 #else
         _gettimeofday(&taskctx->ctime, NULL);
 #endif
-        count_list_add_tail(&taskctx->hook, &sche->runable[taskctx->group]);
 
         __sche_makecontext(sche, taskctx);
 
+        return taskctx;
+}
+
+/**
+ * @param flag stack class | SCHE_TASK_MIGRATE
+ * @return task id, -1 if the task is not started yet (wait_task or migrate)
+ */
+int IO_FUNC sche_task_new1(const char *name, func_t func, void *arg, int _group,
+                           int flag)
+{
+        int ret, group, stack_class;
+        sche_t *sche = sche_self();
+        taskctx_t *taskctx;
+
+        group = sche_group(_group);
+        stack_class = flag & SCHE_STACK_MASK;
+
+        if (unlikely(flag & SCHE_TASK_MIGRATE)) {
+                // deque full falls back to a local task
+                ret = __sche_task_migrate(sche, name, func, arg, group, stack_class);
+                if (likely(ret == 0))
+                        return -1;
+        }
+
+        DBUG("create task %s group %u\n", name, group);
+
+        LTG_ASSERT(group >= SCHE_GROUP0 && group < SCHE_GROUP_MAX);
+        LTG_ASSERT(stack_class >= 0 && stack_class < SCHE_STACK_MAX);
+        LTG_ASSERT(sche);
+
+        taskctx = __sche_task_start(sche, name, func, arg, group, stack_class);
+        if (unlikely(taskctx == NULL)) {
+                ret = __sche_wait_task(name, func, arg, group, stack_class);
+                if (unlikely(ret))
+                        UNIMPLEMENTED(__DUMP__);
+
+                return -1;
+        }
+
         return taskctx->id;
 }
 
+int IO_FUNC sche_task_new(const char *name, func_t func, void *arg, int group)
+{
+        int stack_class = SCHE_STACK_DEFAULT;
+
+        if (unlikely(ltgconf_global.stack_profile == SCHE_STACK_PROF_AUTO)) {
+                stack_class = __sche_stack_class(sche_self(), func);
+        }
+
+        return sche_task_new1(name, func, arg, group, stack_class);
+}
+
+/**
+ * create count tasks with one bookkeeping pass: the stack class is looked
+ * up once per run of the same func and all tasks share one ctime; tasks
+ * without a taskctx or stack go to wait_task like sche_task_new.
+ *
+ * @return number of tasks started now
+ */
+int IO_FUNC sche_task_new_batch(const char *name, const sche_batch_t *batch,
+                                int count)
+{
+        int ret, i, started = 0, stack_class = SCHE_STACK_DEFAULT;
+        sche_t *sche = sche_self();
+        taskctx_t *taskctx, *first = NULL;
+
+        LTG_ASSERT(sche);
+
+        for (i = 0; i < count; i++) {
+                const sche_batch_t *ent = &batch[i];
+                int group = sche_group(ent->group);
+
+                if (unlikely(ltgconf_global.stack_profile == SCHE_STACK_PROF_AUTO)
+                    && (i == 0 || ent->func != batch[i - 1].func)) {
+                        stack_class = __sche_stack_class(sche, ent->func);
+                }
+
+                LTG_ASSERT(group >= SCHE_GROUP0 && group < SCHE_GROUP_MAX);
+
+                taskctx = NULL;
+                if (likely(__sche_task_hasfree(sche))) {
+                        taskctx = __sche_task_init(sche, name, ent->func,
+                                                   ent->arg, group, stack_class);
+                }
+
+                if (unlikely(taskctx == NULL)) {
+                        ret = __sche_wait_task(name, ent->func, ent->arg,
+                                               group, stack_class);
+                        if (unlikely(ret))
+                                UNIMPLEMENTED(__DUMP__);
+
+                        continue;
+                }
+
+                if (first == NULL) {
+                        first = taskctx;
+#if SCHEDULE_TASKCTX_RUNTIME
+                        first->ctime = get_rdtsc();
+#else
+                        _gettimeofday(&first->ctime, NULL);
+#endif
+                } else {
+                        taskctx->ctime = first->ctime;
+                }
+
+                __sche_makecontext(sche, taskctx);
+                started++;
+        }
+
+        return started;
+}
+
+/**
+ * run-to-completion, func runs on the caller's stack without a taskctx.
+ * it must not yield, sche_yield1 asserts that and sche_maybe_yield does
+ * nothing here.
+ */
+void IO_FUNC sche_task_inline(const char *name, func_t func, void *arg)
+{
+        sche_t *sche = sche_self();
+
+        (void) name;
+
+        if (unlikely(sche == NULL)) {
+                func(arg);
+                return;
+        }
+
+        sche->nonblock++;
+        func(arg);
+        sche->nonblock--;
+        sche->c_inline++;
+}
+
 #define REQUEST_SEM 1
 #define REQUEST_TASK 2
 
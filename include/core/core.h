@@ -35,6 +35,7 @@ typedef int (*core_func)();
 typedef void (*core_exit)();
 
 #define CORE_MAX 64
+#define CORE_STEAL_BACKOFF 64           // max idle rounds between steal tries
 #define LTG_TLS_MAX_KEEP (LTG_TLS_MAX * 2)
 
 typedef struct {
@@ -68,12 +69,38 @@ typedef struct __routine {
 #define ENABLE_RING_REQUEST_QUEUE 0
 
 typedef struct {
-        struct ringbuf **ringbuf;
+        struct ringbuf **ringbuf;       // inbound, index by producer core
         struct list_head list;
+
+        // outbound, index by target core, owner only
+        count_list_t *overflow;         // ring full, drained by core_ring_flush
+        int overflow_count;
+        uint8_t *doorbell;              // sche_post pending this round
+        int *doorbell_list;
+        int doorbell_count;
+
+        uint64_t spill;                 // messages queued to overflow
+        uint64_t full;                  // core_ring_wait slept on overflow
+        uint64_t post;                  // doorbells rung
+        uint64_t saved;                 // doorbells coalesced
 } core_ring_t;
 
+typedef struct {
+        int count;              // inbound messages queued
+        int overflow;           // outbound messages waiting for room
+        uint64_t spill;
+        uint64_t full;
+        uint64_t post;
+        uint64_t saved;
+} core_ring_stat_t;
+
 //typedef core_t;
 
+typedef struct {
+        int count;
+        int coreid[CORE_MAX];
+} coremask_t;
+
 typedef struct __core {
         core_ring_t *ring;
         char name[MAX_NAME_LEN];
@@ -102,6 +129,27 @@ typedef struct __core {
         struct list_head scan_list;
         uint64_t stat_nr1;
         uint64_t stat_nr2;
+        uint64_t stat_wakeup;
+        uint64_t stat_inline;
+        // __core_steal, victims of a random pair, backoff while none found
+        coremask_t steal_mask;
+        uint32_t steal_seed;
+        uint32_t steal_skip;    // idle rounds left before the next try
+        uint32_t steal_backoff;
+
+        // poll loop utilisation, see core_load.c
+        uint64_t poll_event;    // events dispatched by corenet_tcp_poll
+        uint64_t loop_tsc;      // rdtsc at the end of the last loop
+        uint64_t idle_tsc;      // rdtsc spent in loops that did nothing
+
+        // hybrid polling (ltgconf.polling_idle), spin then block in the poller
+        int hybrid;
+        int armed;              // pollers may block this round
+        uint64_t idle_begin;    // rdtsc, 0 while busy
+        uint64_t stat_spin;     // usec idle spinning
+        uint64_t stat_sleep;    // usec blocked
+        uint64_t stat_wake;     // wakeups by sche_post
+        uint64_t stat_wake_lat; // usec, sche_post to running
         struct timeval  stat_t1;
         struct timeval  stat_t2;
         void *tls[LTG_TLS_MAX_KEEP];
@@ -130,24 +178,53 @@ int core_usedby(uint64_t mask, int idx);
 int core_used(int idx);
 int core_count(uint64_t mask);
 uint64_t core_mask();
+// hash CORE_ANY places the socket on the least loaded core
 int core_attach(int hash, const sockid_t *sockid, const char *name, void *ctx,
                 core_exec func, func_t reset, func_t check);
 core_t *core_get(int hash);
 core_t *core_self();
+int core_poll_tmo(core_t *core);
 
 int core_request(int coreid, int group, const char *name, func_va_t exec, ...);
 int core_ring_wait(int hash, int priority, const char *name, func_va_t exec, ...);
+
+/**
+ * typed cross-core call, up to CORE_CALL_ARG_MAX bytes of argument are
+ * copied into the ring slot and func runs on the target poller without a
+ * task, so it must not yield. core_call copies the blob back, func may
+ * write its reply in place. core_call_async does not wait.
+ */
+#define CORE_CALL_ARG_MAX 64
+
+typedef int (*core_call_func_t)(void *arg);
+
+int core_call(int coreid, const char *name, core_call_func_t func, void *arg, int len);
+int core_call_async(int coreid, const char *name, core_call_func_t func,
+                    const void *arg, int len);
 void core_tls_set(int type, void *ptr);
 void *core_tls_get(void *core, int type);
 
 int core_islocal(const coreid_t *coreid);
 int core_getid(coreid_t *coreid);
+/**
+ * run map on every core of coremask at once, then fold the per core
+ * results (size bytes each, NULL if size is 0) with reduce on the caller,
+ * in core order. returns the first map error, else the reduce one.
+ */
+typedef int (*core_map_t)(void *arg, void *result);
+typedef int (*core_reduce_t)(void *acc, const void *result, int coreid);
+
+int core_broadcast(const char *name, uint64_t coremask, core_map_t map, void *arg,
+                   int size, core_reduce_t reduce, void *acc);
 int core_init_modules(const char *name, func_va_t exec, ...);
 int core_init_modules1(const char *name, uint64_t coremask, func_va_t exec, ...);
 void core_occupy(const char *name, uint64_t coremask);
 void core_iterator(func1_t func, const void *opaque);
 void core_latency_update(uint64_t used);
 int core_dump_memory(uint64_t *memory);
+void core_dump_stack();
+void core_dump_prof();
+void core_dump_numa();
 int core_latency_init();
 
 int core_register_destroy(const char *name, func2_t func, void *ctx);
@@ -164,6 +241,8 @@ void core_ring_queue(int coreid, ring_ctx_t *ctx,
                       func_t reply, void *replyctx);
 #endif
 void  core_ring_poller(void *_core, void *var, void *arg);
+void core_ring_flush(core_t *core);
+int core_ring_count(core_t *core, core_ring_stat_t *stat);
 void  tgt_core_ring_poller(void *_core, void *var, void *arg);
 void core_worker_run(core_t *core);
 
@@ -188,10 +267,12 @@ void core_worker_run(core_t *core);
 
 uint64_t core_latency_get();
 
-typedef struct {
-        int count;
-        int coreid[CORE_MAX];
-} coremask_t;
+// VARIABLE_LOADBALANCE, see core_load.c
+#define CORE_ANY -1
+
+int core_load_init();
+uint32_t core_load(int hash);
+int core_balance(uint64_t mask);
 
 void coremask_trans(coremask_t *coremask, uint64_t mask);
 int coremask_hash(const coremask_t *coremask, uint64_t id);
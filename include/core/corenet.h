@@ -228,6 +228,15 @@ enum corenet_rdma_op_code {
 #else
 #define CORE_IOV_MAX (1024 * 1)
 #endif
+#define CORENET_TCP_RECV_WIN (512 * 1024)           // per connection receive window
+#define CORENET_TCP_RECV_MAX (CORENET_TCP_RECV_WIN * 4) // bytes read per event
+#define CORENET_TCP_RECV_WINS 32                        // hugepage windows per core, sys beyond
+#define CORENET_TCP_RECV_COPY (4 * 1024)                // reads this small are copied out
+#define CORENET_URING_ENTRIES 1024
+#define CORENET_URING_BUF_COUNT 128                     // provided recv buffers per core
+#define CORENET_URING_BUF_SIZE (32 * 1024)
+#define CORENET_URING_BGID 0
+#define CORENET_URING_IOV 64                            // iov per sendmsg
 #define DEFAULT_MH_NUM 1024
 #define MAX_REQ_NUM ((DEFAULT_MH_NUM) / 2)
 #define EXTRA_SIZE (4)
@@ -243,9 +252,43 @@ typedef struct {
         func_t recv;
         func_t check;
 
+        // exec never yields, the poller parses frames without a task.
+        // corerpc_recv starts a task itself for progs not NET_PROG_NONBLOCK
+        int nonblock;
+
         ltgbuf_t send_buf;
         ltgbuf_t recv_buf;
 
+        // hugepage receive window, recvmsg fills it from recv_off and the
+        // new bytes go to recv_buf as slices, renewed once full. recv_huge
+        // is set while the window counts against corenet_tcp_t.recv_wins
+        ltgbuf_t recv_win;
+        uint32_t recv_off;
+        int recv_huge;
+
+        // io_uring backend, CORENET_URING_SEND while a sendmsg is in flight,
+        // uring_send holds its msghdr and the bytes it covers
+        int uring;
+        void *uring_send;
+        struct list_head uring_arm;     // corenet_tcp_t.uring_arm, sq was full
+
+        // MSG_ZEROCOPY, bytes sent stay referenced on zc_list until the
+        // error queue reports their send call done, zc_next numbers the calls
+        int zerocopy;
+        uint32_t zc_next;
+        struct list_head zc_list;
+
+        // corenet_tcp_send staging, linked to corenet.forward_list by
+        // send_list while not empty, moved to send_buf by corenet_tcp_commit
+        ltgbuf_t queue_buf;
+        struct list_head send_list;
+
+        // flush policy, queue_buf below flush_bytes is held until flush_delay
+        // (rdtsc) after queue_time, flush_bytes 0 is latency mode
+        uint32_t flush_bytes;
+        uint64_t flush_delay;
+        uint64_t queue_time;
+
 #if ENABLE_TCP_THREAD
         plock_t rwlock;
 #endif
@@ -343,11 +386,36 @@ typedef struct {
         corenet_rdma_node_t array[0];
 } corenet_rdma_t;
 
+struct io_uring_sqe;
+struct io_uring_cqe;
+typedef struct corenet_uring corenet_uring_t;
+typedef void (*corenet_uring_func)(void *ctx, const struct io_uring_cqe *cqe);
+
+int corenet_uring_create(corenet_uring_t **_uring, uint32_t entries,
+                         uint32_t buf_count, uint32_t buf_size);
+struct io_uring_sqe *corenet_uring_sqe(corenet_uring_t *uring);
+int corenet_uring_submit(corenet_uring_t *uring);
+int corenet_uring_poll(corenet_uring_t *uring, int tmo,
+                       corenet_uring_func func, void *ctx);
+int corenet_uring_buf_take(corenet_uring_t *uring, int bid, uint32_t len, ltgbuf_t *buf);
+void corenet_uring_buf_put(corenet_uring_t *uring, int bid);
+
 typedef struct {
         corenet_t corenet;
 #if !ENABLE_TCP_THREAD
         struct iovec iov[CORE_IOV_MAX]; //iov for send/recv
+        corenet_uring_t *uring;         // NULL on epoll
+        struct list_head uring_arm;     // recv/poll arm deferred, sq was full
+        int recv_wins;                  // hugepage receive windows held
 #endif
+        uint64_t c_msg;                 // corenet_tcp_send
+        uint64_t c_write;               // sendmsg
+        uint64_t c_byte;
+        uint64_t c_hold;                // commit rounds a connection was held
+        uint64_t last_msg;
+        uint64_t last_write;
+        uint64_t last_byte;
+        uint64_t last_hold;
         corenet_tcp_node_t array[0];
 } corenet_tcp_t;
 
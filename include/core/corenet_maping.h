@@ -6,13 +6,20 @@
 #include "ltg_core.h"
 
 #define CORENET_DEV_MAX 10
+#define CORENET_LANE_MAX 8               // connections per peer core
+#define CORENET_LANE_BULK (64 * 1024)    // default size for bulk lanes
 
 typedef int (*corerpc_request)(void *ctx, void *);
 
 typedef struct {
         nid_t nid;
         uint64_t coremask;
-        sockid_t sockid[CORE_MAX];
+        sockid_t sockid[CORE_MAX];      // lane 0, small rpc
+        sockid_t *lane;                 // lane 1 .. lanes - 1, bulk, CORE_MAX each
+        int lanes;
+        uint32_t cursor;
+        uint32_t gen;
+        uint8_t repair[CORE_MAX];       // lanes under reconnect, bitmap
 
         ltg_spinlock_t lock;
         struct list_head list;
@@ -26,7 +33,7 @@ int corenet_maping_init();
 void corenet_maping_destroy(corenet_maping_t **maping);
 int corenet_maping_connected(const nid_t *nid, const sockid_t *sockid);
 void corenet_maping_close(const nid_t *nid, const sockid_t *sockid);
-int corenet_maping(void *core, const coreid_t *coreid, sockid_t *sockid);
+int corenet_maping(void *core, const coreid_t *coreid, int size, sockid_t *sockid);
 
 int corenet_maping_register(uint64_t coremask);
 void corenet_maping_check(const ltg_net_info_t *info);
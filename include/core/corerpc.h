@@ -49,12 +49,26 @@ typedef struct corerpc_op {
         int msg_type;
         int msg_size;
         int timeout;
+        uint32_t deadline;      // usec budget inherited from the task
         uint32_t group;
         sockid_t sockid;
         msgid_t msgid;
 } corerpc_op_t;
 
+typedef struct {
+        sche_future_t future;
+        corerpc_op_t op;
+        uint64_t latency;
+} corerpc_future_t;
+
 void corerpc_register(int type, net_request_handler handler, void *context);
+/**
+ * @param flag NET_PROG_NONBLOCK, the handler runs to completion inline and
+ *        must not yield, sleep or lock; sche_task_* of the current task
+ *        is not available to it.
+ */
+void corerpc_register1(int type, net_request_handler handler, void *context,
+                       int flag);
 
 int corerpc_postwait(const char *name, const coreid_t *coreid, const void *request,
                      int reqlen, const ltgbuf_t *wbuf, ltgbuf_t *rbuf,
@@ -73,6 +87,22 @@ int corerpc_postwait_sock(const char *name, const coreid_t *coreid,
                           int reqlen, const ltgbuf_t *wbuf, ltgbuf_t *rbuf,
                           int msg_type, int msg_size, int group, int timeout);
 
+/**
+ * fan-out: corerpc_post returns at once, the reply completes the future.
+ * the deadline of the calling task (sche_task_deadline_set) is shared by
+ * all requests posted under it. a failed post completes its future with
+ * the error too. futures not completed by the wait must be released
+ * before they go out of scope. ENOSYS outside of a daemon with corerpc
+ * inited, use corerpc_postwait there.
+ */
+int corerpc_post(const char *name, corerpc_future_t *future, const coreid_t *coreid,
+                 const void *request, int reqlen, const ltgbuf_t *wbuf, ltgbuf_t *rbuf,
+                 int msg_type, int msg_size, int group, int timeout);
+int corerpc_wait_all(corerpc_future_t *futures, int count);
+int corerpc_wait_any(corerpc_future_t *futures, int count, int *idx);
+int corerpc_wait_quorum(corerpc_future_t *futures, int count, int k);
+void corerpc_future_release(corerpc_future_t *futures, int count);
+
 void corerpc_reply(const sockid_t *sockid, const msgid_t *msgid, const void *_buf, int len);
 void corerpc_reply_buffer(const sockid_t *sockid, const msgid_t *msgid, ltgbuf_t *_buf);
 void corerpc_reply_error(const sockid_t *sockid, const msgid_t *msgid, int _error);
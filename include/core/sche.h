@@ -5,11 +5,14 @@
  *
  * 协程是一种非连续执行的机制，每个core thread一个调度器
  *
- * 目前调度器的调度策略：公平调度，不支持优先级调度
- * 对并发运行的任务数有一定限制：1024
+ * 调度策略：任务按group分为SCHE_GROUP_MAX个runable队列，每个core可选
+ * 严格优先级(SCHE_POLICY_STRICT)或加权公平(SCHE_POLICY_WFQ)
+ * 对并发运行的任务数有一定限制：TASK_MAX, taskctx按TASK_CHUNK按需扩展
  *
  * 一些约束：
- * - 每个task有64K的stack，所以不能声明太大的stack上数据，特别是数量多的数组，或大对象。
+ * - 默认stack为DEFAULT_STACK_SIZE，可通过sche_task_new1选择SCHE_STACK_SMALL/LARGE，
+ *   所以不能声明太大的stack上数据，特别是数量多的数组，或大对象。
+ * - stack在任务结束时归还，空闲的stack page归还hugepage
  * - 一个任务的总执行时间不能超过180s，否则会timeout，导致进程退出
  * - IDLE状态的代码，不能加锁，会形成deadlock (@see __rpc_table_check)
  */
@@ -29,18 +32,78 @@
 // #define SCHEDULE_TASKCTX_RUNTIME 1
 #define SCHEDULE_CHECK_IOPS 0
 
-#define TASK_MAX (4096)
+// task_t.taskid is int16_t, ids must stay below INT16_MAX
+#define TASK_MAX (1024 * 32)
+#define TASK_CHUNK (1024)
 
-#define REQUEST_QUEUE_STEP 128
-#define REQUEST_QUEUE_MAX (TASK_MAX * 1)
+#define REQUEST_QUEUE_MAX (4096)
+#define REQUEST_QUEUE_BATCH 64
 
-#define REPLY_QUEUE_STEP 128
-#define REPLY_QUEUE_MAX TASK_MAX
 #define SCHE_NAME_LEN 32
 
 #define KEEP_STACK_SIZE (1024)
 #define DEFAULT_STACK_SIZE (1024 * 128)
 
+#define SCHE_STACK_SMALL 0      // leaf rpc handler, waits on replies only
+#define SCHE_STACK_DEFAULT 1
+#define SCHE_STACK_LARGE 2
+#define SCHE_STACK_MAX 3
+
+#define SCHE_STACK_SIZE {1024 * 16, DEFAULT_STACK_SIZE, 1024 * 512}
+
+/**
+ * sche_task_new1 flag, low bits are the stack class.
+ * SCHE_TASK_MIGRATE: the task keeps no core local state, it is queued in
+ * the steal deque and may be started by an idle polling core instead.
+ * opt in for application tasks, nothing inside ltg sets it: rpc and
+ * corenet tasks are bound to the core of their socket and rpc_table.
+ */
+#define SCHE_STACK_MASK 0xff
+#define SCHE_TASK_MIGRATE 0x100
+
+#define SCHE_DEQUE_SIZE 1024
+#define SCHE_STEAL_BATCH 8               // owner pops per sche_run when idle
+
+// stacks of one class are carved from a STACK_PAGE_SIZE page
+#define STACK_PAGE_SIZE HUGEPAGE_SIZE
+
+/**
+ * ltgconf.stack_profile, ON paints the stack at task start and records the
+ * depth by task function when it returns, AUTO also runs sche_task_new on
+ * the smallest class holding twice the max depth seen (after
+ * SCHE_STACK_PROF_SAMPLE runs). past the first SCHE_STACK_PROF_SAMPLE runs
+ * only one start in SCHE_STACK_PROF_EVERY of a function is painted.
+ */
+#define SCHE_STACK_PROF_OFF 0
+#define SCHE_STACK_PROF_ON 1
+#define SCHE_STACK_PROF_AUTO 2
+
+#define SCHE_STACK_PROF_MAX 256         // task functions per sche
+#define SCHE_STACK_PROF_SAMPLE 128
+#define SCHE_STACK_PROF_EVERY 64
+#define SCHE_STACK_PROF_HIST 10         // depth <= 1k << i
+#define SCHE_STACK_PAINT 0xa5a5a5a5a5a5a5a5ULL
+
+// small stacks have no guard page (hugepage carved), the lowest words
+// above KEEP_STACK_SIZE hold a canary checked when the stack is put back.
+// it only catches small overruns, a frame jumping past the canary corrupts
+// the stack below unseen, and the check runs after the task is done
+#define SCHE_STACK_CANARY 0x5a5a5a5a5a5a5a5aULL
+#define SCHE_STACK_CANARY_SIZE 256
+
+/**
+ * ltgconf.task_profile, per sche histograms keyed by name, written by the
+ * owner only and read through sche_prof_snapshot from any thread.
+ */
+#define SCHE_PROF_RUN 0         // run time per resume, by task name
+#define SCHE_PROF_CPU 1         // on-cpu time of a whole task, by task name
+#define SCHE_PROF_WAIT 2        // yield to resume, by sche_yield name
+#define SCHE_PROF_SLICE 3       // resumes over ltgconf.task_slice, by task name
+#define SCHE_PROF_TYPE 4
+
+#define SCHE_PROF_MAX 256       // names per type
+#define SCHE_PROF_HIST 20       // ns <= 256 << i, the last one unbounded
+
 #if 1
 #define NEW_SCHED
 #endif
@@ -60,6 +123,20 @@ typedef struct reply_remote {
         int retval;
 } reply_remote_t;
 
+#define REPLY_RING_SIZE 128
+
+/**
+ * cross core wakeup queue, one per (producer sche, consumer sche).
+ * entries are preallocated and reused in ring order, head is only written
+ * by the producer and tail only by the consumer.
+ */
+typedef struct {
+        uint32_t head __attribute__((__aligned__(CACHE_LINE_SIZE)));
+        uint32_t tail __attribute__((__aligned__(CACHE_LINE_SIZE)));
+        int producer;
+        reply_remote_t entry[REPLY_RING_SIZE];
+} reply_ring_t;
+
 typedef enum {
         TASK_STAT_FREE = 10, //0
         TASK_STAT_RUNNABLE,  //1
@@ -103,6 +180,10 @@ typedef struct __task {
 
         void *sche;
         void *stack;
+        void *stack_page;       // sche_stack_page_t
+        uint32_t stack_size;
+        int8_t stack_class;
+        int8_t stack_paint;     // painted at start, stack_profile sample
         // for sche->running_task_list;
 
         char name[MAX_NAME_LEN];
@@ -123,6 +204,7 @@ typedef struct __task {
         taskstate_t state;
         char pre_yield;
         char sleeping;
+        char posted;            // linked to sche->reply_local
         int8_t step;
         int8_t group;
         int8_t wait_tmo;
@@ -135,6 +217,8 @@ typedef struct __task {
         uint32_t fingerprint;
 
         time_t wait_begin;
+        uint64_t deadline;      // rdtsc, 0 means no deadline
+        uint64_t cpu_time;      // rdtsc, for SCHE_PROF_CPU
 
         uint32_t value[TASK_VALUE_MAX];
 
@@ -153,48 +237,142 @@ typedef struct {
 } request_t;
 
 typedef struct {
-        ltg_spinlock_t lock;
-        int count;
-        int max;
-        request_t *requests;
-} request_queue_t;
+        func_t func;
+        void *arg;
+        int8_t group;
+} sche_batch_t;
+
+/**
+ * future, completed once by sche_future_set on the core of the waiter,
+ * one task waits for k of n futures with sche_future_wait.
+ */
+#define SCHE_FUTURE_MAX 64
 
 typedef struct {
         task_t task;
+        int need;               // successes to wake up
+        int fail_max;           // failures tolerated
+        int done;
+        int fail;
+        int retval;             // first failure
+        int posted;
+} sche_future_wait_t;
+
+typedef struct {
+        int done;
         int retval;
-        ltgbuf_t *buf;
-} reply_t;
+        sche_future_wait_t *wait;
+} sche_future_t;
+
+typedef struct {
+        struct list_head hook;
+        void *addr;
+        int stack_class;
+        int hugepage;
+        int used;
+        int total;
+        struct list_head free;  // free stacks, list_head at stack bottom
+} sche_stack_page_t;
+
+typedef struct {
+        func_t func;
+        void *arg;
+        int8_t group;
+        int8_t stack_class;
+        char name[SCHE_NAME_LEN];
+} steal_task_t;
+
+/**
+ * Chase-Lev deque of not yet started migratable tasks, the owner sche
+ * pushes/pops at bottom, thieves take from top with CAS.
+ */
+typedef struct {
+        int64_t top __attribute__((__aligned__(CACHE_LINE_SIZE)));
+        int64_t bottom __attribute__((__aligned__(CACHE_LINE_SIZE)));
+        steal_task_t entry[SCHE_DEQUE_SIZE];
+} steal_deque_t;
+
+typedef struct {
+        func_t func;            // key, NULL if unused
+        char name[MAX_NAME_LEN];        // first task name seen, for dump
+        int8_t stack_class;     // picked by AUTO, -1 if not yet
+        uint32_t start;         // starts, one in SCHE_STACK_PROF_EVERY painted
+        uint32_t max;
+        uint64_t count;
+        uint64_t hist[SCHE_STACK_PROF_HIST];
+} sche_stack_prof_t;
+
+typedef struct {
+        uint32_t seq;           // odd while the owner updates
+        char name[MAX_NAME_LEN];
+        uint64_t count;
+        uint64_t sum;           // ns
+        uint64_t max;           // ns
+        uint64_t hist[SCHE_PROF_HIST];
+} sche_prof_t;
 
 typedef struct {
-        ltg_spinlock_t lock;
-        int count;
-        int max;
-        reply_t *replys;
-} reply_queue_t;
-
-#if 0
-#define SCHE_GROUP0 0
-#define SCHE_GROUP1 1
-#define SCHE_GROUP2 2
-#define SCHE_GROUP3 3
-//#define SCHE_GROUP4 4
+        // pages with free stacks at head, full pages at tail
+        struct list_head page_list;
+        int page_count;
+        int empty;              // pages without used stack, at most one kept
+        uint32_t stack_size;
+        uint64_t used;
+} sche_stack_pool_t;
+
+/**
+ * bounded mpsc queue, request_t entries are preallocated and handed out
+ * through the free ring, sche_request returns EAGAIN when it is empty.
+ */
+typedef struct {
+        struct ringbuf *queue;  // mp enqueue, sc dequeue by the owner sche
+        struct ringbuf *free;   // sp enqueue by the owner sche, mc dequeue
+        request_t *requests;
+        uint32_t hwm;           // high water mark of queue depth
+        uint64_t full;          // EAGAIN returned to producers
+} request_queue_t;
+
+/**
+ * runable classes, lower value is higher priority.
+ * group -1 or out of range (e.g. ltg_net_head_t.group from a peer) maps to
+ * SCHE_GROUP_DEFAULT.
+ */
+#define SCHE_GROUP0 0   // latency critical: small rpc, metadata, heartbeat
+#define SCHE_GROUP1 1   // normal
+#define SCHE_GROUP2 2   // bulk io
+#define SCHE_GROUP3 3   // background: scan
 #define SCHE_GROUP_MAX 4
 
-#else
+#define SCHE_GROUP_DEFAULT SCHE_GROUP1
 
-#define SCHE_GROUP0 0
-#define SCHE_GROUP1 0
-#define SCHE_GROUP2 0
-#define SCHE_GROUP3 0
-//#define SCHE_GROUP4 0
-#define SCHE_GROUP_MAX 1
+#define SCHE_POLICY_STRICT 0
+#define SCHE_POLICY_WFQ 1
 
-#endif
+// tasks run per round for each group in SCHE_POLICY_WFQ
+#define SCHE_GROUP_WEIGHT {8, 4, 2, 1}
+
+typedef struct {
+        uint64_t queue;         // enqueued to runable
+        uint64_t run;           // swapped in
+        uint64_t run_time;      // rdtsc
+} sche_group_stat_t;
+
+static inline int sche_group(int group)
+{
+        if (unlikely(group < 0 || group >= SCHE_GROUP_MAX))
+                return SCHE_GROUP_DEFAULT;
+
+        return group;
+}
+
+#define sche_taskctx(__sche__, __id__) \
+        (&(__sche__)->tasks[(__id__) / TASK_CHUNK][(__id__) % TASK_CHUNK])
 
 typedef struct sche_t {
         // scher
         char name[32];
         int id;
+        int node;               // numa node of the owning core, -1 unknown
 
 #if SCHEDULE_CHECK_IOPS
         struct timeval t1, t2;
@@ -206,11 +384,28 @@ typedef struct sche_t {
         int running;
         int suspendable;
 
-        // coroutine
+        // hybrid polling core, eventfd is only written while armed
+        int hybrid;
+        int armed;
+        uint64_t post_time;     // rdtsc of the last armed sche_post
+
+        // sche_task_inline, run-to-completion handlers
+        int nonblock;
+        uint64_t c_inline;
+
+        // ltgconf.task_slice in rdtsc, 0 means no budget
+        uint64_t slice;
+        uint64_t c_overrun;     // resumes that ran past the slice
+        uint64_t c_preempt;     // sche_maybe_yield requeued the task
+
+        // coroutine, tasks[id / TASK_CHUNK][id % TASK_CHUNK]
         void *private_mem;
-        taskctx_t *tasks;
+        taskctx_t **tasks;
         void *stack_addr;
-        int size;
+        int size;               // taskctx allocated
+        sche_stack_pool_t stack_pool[SCHE_STACK_MAX];
+        sche_stack_prof_t *stack_prof;  // SCHE_STACK_PROF_MAX, open addressing
+        sche_prof_t *prof[SCHE_PROF_TYPE];      // SCHE_PROF_MAX, open addressing
 
         // no free task count
         int task_count;
@@ -229,18 +424,34 @@ typedef struct sche_t {
         // core_request的请求，先放入队列，而后才生成task
         request_queue_t request_queue;
 
+        // SCHE_TASK_MIGRATE的任务，未开始前可被其他core偷走
+        steal_deque_t *steal_deque;
+        uint64_t steal;                 // tasks stolen from other sche
+        uint64_t steal_fail;            // lost the race to the owner/thief
+
         // 当前可调度的任务队列
         count_list_t runable[SCHE_GROUP_MAX];
+        int policy;
+        int weight[SCHE_GROUP_MAX];
+        sche_group_stat_t group_stat[SCHE_GROUP_MAX];
 
         // resume相关, local是本调度器上的任务，remote是跨core任务(需要MT同步）
-        reply_queue_t reply_local;
+        // reply_local链接等待的taskctx->hook, retval和buf直接存放在taskctx里
+        count_list_t reply_local;
+        // sche_maybe_yield的任务, poll之后才回到reply_local, poll_seq由
+        // core在poller之后增加, defer_seq是最后一次延后时的poll_seq
+        count_list_t reply_defer;
+        uint32_t poll_seq;
+        uint32_t defer_seq;
         
+        // reply_remote_list只用于没有sche的线程或reply_ring满的情况
         ltg_spinlock_t reply_remote_lock;
         struct list_head reply_remote_list;
+        reply_ring_t **reply_ring;              // index by producer sche id
+        reply_ring_t **reply_ring_array;        // drained by sche_run
+        int reply_ring_count;
+        uint64_t reply_remote_count;            // remote wakeups received
 
-        void *task_hpage;
-        int task_hpage_offset;
-        
         // backtrace
         uint32_t sequence;
         uint32_t scan_seq;
@@ -270,8 +481,21 @@ int sche_stat(int *sid, int *taskid, int *runable, int *wait_task,
               int *task_count, uint64_t *run_time, uint64_t *c_runtime);
 
 
+int sche_policy_set(sche_t *sche, int policy, const int *weight);
+void sche_group_stat(sche_t *sche, int group, sche_group_stat_t *stat);
+
 int sche_request(sche_t *sche, int group, func_t exec, void *buf, const char *name);
+int sche_request_wait(sche_t *sche, int group, func_t exec, void *buf, const char *name);
+void sche_request_stat(sche_t *sche, int *depth, int *hwm, uint64_t *full);
 int sche_task_new(const char *name, func_t func, void *arg, int group);
+int sche_task_new1(const char *name, func_t func, void *arg, int group,
+                   int flag);
+int sche_task_new_batch(const char *name, const sche_batch_t *batch, int count);
+void sche_task_inline(const char *name, func_t func, void *arg);
+int sche_steal(sche_t *sche, sche_t *victim, int max);
+void sche_future_init(sche_future_t *future);
+void sche_future_set(sche_future_t *future, int retval);
+int sche_future_wait(const char *name, sche_future_t **futures, int count, int k);
 task_t sche_task_get();
 void sche_task_given(task_t *task);
 int sche_task_get1(sche_t *sche, task_t *task);
@@ -310,9 +534,39 @@ int sche_taskid();
 
 void sche_task_setname(const char *name);
 
+/**
+ * 任务截止时间，只能收紧；corerpc_postwait* 会继承并携带剩余预算
+ *
+ * @param usec budget from now, 0 clears the deadline
+ */
+void sche_task_deadline_set(uint64_t usec);
+void sche_task_deadline_abs(uint64_t deadline);
+/**
+ * @return remaining usec, -1 if the task has no deadline, 0 if expired
+ */
+int64_t sche_task_deadline_left();
+int sche_task_expired();
+
+/**
+ * 长循环里的让出点，当前任务用完ltgconf.task_slice后重新排队
+ * 不在task中、inline handler中或已sche_task_get时什么都不做
+ *
+ * @return 1 if the task was requeued
+ */
+int sche_maybe_yield();
+void sche_polled(sche_t *sche);
+
+static inline uint64_t sche_deadline(const sche_t *sche, uint64_t usec)
+{
+        return get_rdtsc() + usec * (sche->hz / (1000 * 1000));
+}
+
 // internals
 
 void sche_post(sche_t *sche);
+void sche_hybrid_set(sche_t *sche);
+int sche_arm(sche_t *sche);
+void sche_disarm(sche_t *sche);
 
 void sche_scan(sche_t *sche);
 void sche_backtrace();
@@ -337,6 +591,13 @@ void sche_value_set(int key, uint32_t value);
 int sche_task_uptime();
 void sche_value_get(int key, uint32_t *value);
 void sche_fingerprint_new(sche_t *sche, taskctx_t *taskctx);
+int sche_taskctx_grow(sche_t *sche);
+void sche_stack_init(sche_t *sche);
+void sche_stack_put(sche_t *sche, taskctx_t *taskctx);
+int sche_steal_push(sche_t *sche, const steal_task_t *task);
+void sche_stack_stat(sche_t *sche, int stack_class, int *page, uint64_t *used);
+void sche_stack_prof_dump(sche_t *sche);
+int sche_prof_snapshot(sche_t *sche, int type, sche_prof_t *array, int max);
 
 int sche_task_run(int group, func_va_t exec, ...);
 int sche_getid();
@@ -16,6 +16,7 @@
 #include "utils/skiplist.h"
 #include "utils/timer.h"
 #include "utils/analysis.h"
+#include "utils/trace.h"
 #include "utils/fnotify.h"
 #include "utils/etcd.h"
 #include "utils/ltg_global.h"
@@ -21,6 +21,7 @@ int hugepage_init(int daemon, uint64_t coremask, int nr_huge);
 void *hugepage_private_init(int hash, int sockid);
 
 extern int hugepage_getfree(void **addr, uint32_t *size);
+void hugepage_putfree(void *addr, uint32_t size);
 
 void get_global_private_mem(void **private_mem, uint64_t *private_mem_size);
 const struct mem_alloc *buddy_memalloc_reg();
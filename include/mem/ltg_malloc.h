@@ -5,6 +5,9 @@ void *ltg_malloc1(size_t size);
 void ltg_free1(void *ptr);
 int ltg_malloc(void **ptr, size_t size);
 int ltg_malign(void **_ptr, size_t align, size_t size);
+int ltg_malloc_node(void **_ptr, size_t size, int node);
+int ltg_malloc_local(void **_ptr, size_t size);
+int ltg_mem_node(const void *ptr);
 int ltg_realloc(void **_ptr, size_t size, size_t newsize);
 int ltg_free(void **ptr);
 
@@ -103,6 +103,7 @@ int ltgbuf_pop1(ltgbuf_t *buf, ltgbuf_t *newbuf, uint32_t len, int deep);
 
 void ltgbuf_merge(ltgbuf_t *dist, ltgbuf_t *src);
 void ltgbuf_reference(ltgbuf_t *dist, const ltgbuf_t *src);
+int ltgbuf_slice(ltgbuf_t *dist, const ltgbuf_t *src, uint32_t off, uint32_t len);
 void ltgbuf_clone1(ltgbuf_t *newbuf, const ltgbuf_t *buf, int init);
 void ltgbuf_clone(ltgbuf_t *dist, const ltgbuf_t *src);
 void ltgbuf_clone_glob(ltgbuf_t *newbuf, const ltgbuf_t *buf);
@@ -146,6 +147,7 @@ seg_t *seg_sys_create(ltgbuf_t *buf, uint32_t size);
 seg_t *seg_ext_create(ltgbuf_t *buf, void *data, uint32_t size,
                       void *arg, int (*cb)(void *arg));
 seg_t *seg_trans(ltgbuf_t *buf, seg_t *seg);
+seg_t *seg_huge_slice(ltgbuf_t *buf, seg_t *src, uint32_t off, uint32_t len);
 void seg_check(seg_t *seg);
 
 void seg_add_tail(ltgbuf_t *buf, seg_t *seg);
@@ -12,7 +12,13 @@
 #include "sdevent.h"
 #include "ltg_utils.h"
 
-#define LTG_MSG_MAGIC   0x866aa9f0
+/*
+ * ltg_net_head_t layout version, bumped when a field moves. 0x866aa9f0 was
+ * the head without deadline (latency at 80, 88 bytes), peers of the two
+ * layouts reject each other's frames instead of misparsing them.
+ */
+#define LTG_MSG_MAGIC   0x866aa9f1
+#define LTG_INFO_MAGIC  0x866aa9f0
 #define LTG_MSG_ERROR   0x1c3af910
 #define MAX_NODEID_LEN 128
 
@@ -35,6 +41,7 @@ typedef struct  {
         uint32_t group;
         uint32_t coreid;
         uint32_t master_magic;
+        uint32_t deadline;   /* remaining budget in usec, 0 means none */
         uint64_t latency;
         char buf[0];
 } ltg_net_head_t ;
@@ -23,9 +23,13 @@ typedef enum {
         MSG_NET,
 } net_progtype_t;
 
+// handler never yields, run inline on the poller stack without a task
+#define NET_PROG_NONBLOCK 0x01
+
 typedef struct {
         net_request_handler handler;
         void *context;
+        int flag;
 } net_prog_t;
 
 typedef struct {
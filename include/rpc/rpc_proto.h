@@ -10,6 +10,8 @@ typedef struct {
         msgid_t msgid;
         ltgbuf_t buf;
         void *ctx;
+        uint64_t deadline;              // rdtsc, corerpc only
+        void (*handler)(void *);        // run by the deadline wrapper
 } rpc_request_t;
 
 int rpc_pack_handler(const nid_t *nid, const sockid_t *sockid, ltgbuf_t *buf);
@@ -15,6 +15,7 @@ typedef struct {
         uint32_t timeout;
         uint32_t begin;
         uint32_t figerprint_prev;
+        uint64_t deadline;      // rdtsc, 0 means none
         char name[MAX_NAME_LEN];
         void *arg;
         func3_t func;
@@ -28,22 +29,29 @@ typedef struct {
         int cycle;
         int tabid;
         time_t last_scan;
+        uint32_t scan_cur;      // next slot of the pass in progress, 0 idle
+        uint32_t scan_used;
+        uint32_t scan_checked;
+        uint64_t deadline_timer;        // rdtsc the deadline timer fires, 0 none
         uint32_t sequence;
         slot_t *slot[0];
 } rpc_table_t;
 
 #define RPC_TABLE_MAX 8192
+#define RPC_TABLE_SCAN_STEP 512         // slots a private table checks per call
+#define RPC_TABLE_DEADLINE_TICK 1000    // usec, min gap between deadline passes
 
 extern rpc_table_t *__rpc_table__;
 
 int rpc_table_init(const char *name, rpc_table_t **rpc_table, int private);
 void rpc_table_destroy(rpc_table_t **_rpc_table);
 
-void rpc_table_scan(rpc_table_t *rpc_table, int interval, int newtask);
+int rpc_table_scan(rpc_table_t *rpc_table, int interval, int newtask);
 
 int rpc_table_getslot(rpc_table_t *rpc_table, msgid_t *msgid, const char *name);
 int rpc_table_setslot(rpc_table_t *rpc_table, const msgid_t *msgid, func3_t func, void *arg,
                       const sockid_t *sockid, const nid_t *nid, int timeout);
+void rpc_table_deadline(rpc_table_t *rpc_table, const msgid_t *msgid, uint64_t deadline);
 
 int rpc_table_post(rpc_table_t *rpc_table, const msgid_t *msgid, int retval, ltgbuf_t *buf, uint64_t latency);
 int rpc_table_free(rpc_table_t *rpc_table, const msgid_t *msgid);
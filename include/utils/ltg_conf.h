@@ -29,7 +29,9 @@ typedef struct {
         int coreflag;
 
         int polling_timeout;
+        int polling_idle;        // usec, polling core blocks after idle that long, 0 spin
         uint64_t coremask;
+        uint64_t sche_wfq_mask;  // cores use SCHE_POLICY_WFQ, others strict
         int nr_hugepage;
         int daemon;
         
@@ -37,6 +39,15 @@ typedef struct {
         int rmem_max;
         int solomode;
         int performance_analysis;
+        int stack_profile;       // SCHE_STACK_PROF_OFF/ON/AUTO
+        int task_profile;        // run/cpu/wait histograms by name, core_dump_prof
+        int task_slice;          // usec a task may run per resume, 0 unlimited
+        int tcp_uring;           // corenet tcp on io_uring, epoll if the kernel lacks it
+        int tcp_zerocopy;        // bytes, corenet tcp sends this large use MSG_ZEROCOPY, 0 off
+        int tcp_flush_bytes;     // corenet tcp holds less than this per connection,
+        int tcp_flush_delay;     // for up to this many usec, either 0 flushes every round
+        int tcp_lanes;           // corenet tcp connections per peer core, 0 or 1 single
+        int tcp_lane_bulk;       // bytes, rpc this large go on bulk lanes, 0 default
         int nofile_max;
         int hb_timeout;
         int hb_retry;
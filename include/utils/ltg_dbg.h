@@ -33,6 +33,7 @@ extern int rdma_running;
 #define DPERF_PATH            "/msgctl/perf"
 #define DGOTO_PATH            "/msgctl/backtrace"
 #define DLEVEL_PATH           "/msgctl/level"
+#define DTRACE_PATH           "/msgctl/trace"
 
 #define DBUG_PATH             "/msgctl/dbug"
 #define DBUG_UTILS_PATH        "/msgctl/sub/utils"
@@ -11,8 +11,8 @@
 
 typedef struct {
         struct list_head queue;
-        int16_t writer;
-        uint16_t readers;
+        int32_t writer;
+        uint32_t readers;
 #if PLOCK_CHECK
         int thread;
 #endif
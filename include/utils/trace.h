@@ -0,0 +1,68 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+
+/**
+ * per sche thread binary event ring, one writer, overwritten when full.
+ * threads without a sche are not traced.
+ *
+ * /dev/shm/<system>/msgctl/trace: 0 off, 1 on, 2 dump to
+ * /dev/shm/<system>/trace/<idx>.bin, tools/ltg_trace2json.py converts the
+ * dumps to chrome trace json.
+ */
+
+#define TRACE_MAGIC 0x4c544754          // LTGT
+#define TRACE_VERSION 1
+#define TRACE_RING_SIZE (1024 * 64)     // events per ring, power of 2
+#define TRACE_THREAD_MAX 512
+#define TRACE_NAME_LEN 24
+
+typedef enum {
+        TRACE_TASK_CREATE = 1,
+        TRACE_TASK_RESUME,
+        TRACE_TASK_YIELD,               // name is the wait name
+        TRACE_TASK_EXIT,
+        TRACE_RING_ENQ,                 // id target core
+        TRACE_RING_DEQ,                 // arg count
+        TRACE_NET_SEND,                 // id sd, arg bytes
+        TRACE_NET_COMMIT,               // id sd, arg bytes
+        TRACE_NET_RECV,                 // id sd, arg bytes
+        TRACE_RPC_GETSLOT,              // id msgid idx, arg figerprint
+        TRACE_RPC_POST,                 // id msgid idx, arg retval
+        TRACE_MAX,
+} trace_type_t;
+
+typedef struct {
+        uint64_t tsc;
+        uint16_t type;
+        uint16_t thread;
+        uint32_t id;
+        uint64_t arg;
+        char name[TRACE_NAME_LEN];
+} trace_event_t;
+
+typedef struct {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t hz;
+        uint32_t thread;
+        uint32_t count;
+        char name[32];
+        // trace_event_t[count], oldest first
+} trace_file_t;
+
+extern int ltg_trace_on;
+
+void trace_event(int type, uint32_t id, uint64_t arg, const char *name);
+int trace_ctl(int cmd);
+int trace_dump(const char *dir);
+
+#define TRACE(__type__, __id__, __arg__, __name__)                      \
+        do {                                                            \
+                if (unlikely(ltg_trace_on)) {                           \
+                        trace_event(__type__, __id__, __arg__, __name__); \
+                }                                                       \
+        } while (0)
+
+#endif
@@ -259,7 +259,11 @@ inline seg_t *seg_huge_create(ltgbuf_t *buf, uint32_t *size)
         mem_handler_t handler;
         ret = mem_ring_new(&newsize, &handler);
         if (unlikely(ret)) {
-                GOTO(err_free, ret);
+                // hugepages of this core used up, sys memory still works
+                DWARN("huge %u fail, use sys, ret (%d) %s\n", *size, ret,
+                      strerror(ret));
+                __seg_free_head(seg, 0);
+                return seg_sys_create(buf, *size);
         }
 
         if (newsize < *size) {
@@ -280,9 +284,39 @@ inline seg_t *seg_huge_create(ltgbuf_t *buf, uint32_t *size)
         seg->sop.seg_trans = __seg_huge_trans;
         
         return seg;
-err_free:
-        UNIMPLEMENTED(__DUMP__);
-        return NULL;
+}
+
+/*
+ * [off, off + len) of a huge seg as a seg of its own, it takes one more
+ * ref of the ring page so it may outlive src
+ */
+seg_t *seg_huge_slice(ltgbuf_t *buf, seg_t *src, uint32_t off, uint32_t len)
+{
+        int ret;
+        seg_t *seg;
+        mem_handler_t handler;
+
+        LTG_ASSERT(off + len <= src->len);
+
+        if (unlikely(src->sop.seg_share != __seg_huge_share)) {
+                return NULL;
+        }
+
+        handler.pool = src->huge.pool;
+        handler.head = src->huge.head;
+        handler.ptr = src->handler.ptr;
+        handler.phyaddr = src->handler.phyaddr;
+        ret = mem_ring_ref(&handler);
+        if (unlikely(ret))
+                return NULL;
+
+        seg = __seg_alloc_head(buf, len, 0);
+        seg->huge = src->huge;
+        seg->handler.ptr = src->handler.ptr + off;
+        seg->handler.phyaddr = src->handler.phyaddr + off;
+        seg->sop = src->sop;
+
+        return seg;
 }
 
 #else
@@ -292,6 +326,16 @@ inline seg_t *seg_huge_create(ltgbuf_t *buf, uint32_t *size)
         return seg_sys_create(buf, *size);
 }
 
+seg_t *seg_huge_slice(ltgbuf_t *buf, seg_t *src, uint32_t off, uint32_t len)
+{
+        (void) buf;
+        (void) src;
+        (void) off;
+        (void) len;
+
+        return NULL;
+}
+
 static seg_t *__seg_huge_share(ltgbuf_t *buf, seg_t *src)
 {
         return __seg_sys_share(buf, src);
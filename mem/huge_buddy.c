@@ -85,8 +85,8 @@ int buddy_alloc(void *buddy_addr, void **_addr, uint32_t *size)
 
         index = __buddy_alloc(buddy_addr, req_size >> 21);
         if (unlikely(index < 0)) {
-                    DERROR("hugepage full\n");
-                    EXIT(EAGAIN);
+                DWARN("hugepage full\n");
+                return ENOMEM;
         }
 
         *size = req_size;
@@ -135,9 +135,17 @@ int __buddy_free(void *buddy_addr, uint32_t offset)
 
 int buddy_free(void *buddy_addr, void *free_addr, uint32_t size)
 {
-        (void)buddy_addr;
-        (void)free_addr;
+        void *start_addr = (void *)((uint64_t)buddy_addr & (~(((uint64_t)1 << 21) -1))) + HUGEPAGE_SIZE;
+
         (void)size;
+
+        LTG_ASSERT(free_addr >= start_addr);
+        LTG_ASSERT(((uint64_t)(free_addr - start_addr) & (HUGEPAGE_SIZE - 1)) == 0);
+
+        __buddy_free(buddy_addr, (free_addr - start_addr) / HUGEPAGE_SIZE);
+
+        DINFO("buddy free addr %p start addr %p\n", free_addr, start_addr);
+
         return 0;
 }
 
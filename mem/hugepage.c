@@ -265,11 +265,12 @@ int hugepage_getfree(void **_addr, uint32_t *size)
                         ltg_spin_lock(&head->lock);
 
                 ret = head->ops->alloc((void *)head + sizeof(*head), _addr, size);
-                if (ret)
-                        GOTO(err_ret, ret);
 
                 if (unlikely(head == __hugepage__))
                         ltg_spin_unlock(&head->lock);
+
+                if (ret)
+                        GOTO(err_ret, ret);
         }
 
         return 0;
@@ -277,6 +278,28 @@ err_ret:
         return ret;
 }
 
+/**
+ * give back memory from hugepage_getfree, must be called by the same thread
+ */
+void hugepage_putfree(void *addr, uint32_t size)
+{
+        hugepage_head_t *head = __private_huge__ ? __private_huge__ : __hugepage__;
+
+        LTG_ASSERT(size % HUGEPAGE_SIZE == 0);
+
+        if (unlikely(head == NULL)) {
+                __posix_alloc__->free(NULL, addr, size);
+        } else {
+                if (unlikely(head == __hugepage__))
+                        ltg_spin_lock(&head->lock);
+
+                head->ops->free((void *)head + sizeof(*head), addr, size);
+
+                if (unlikely(head == __hugepage__))
+                        ltg_spin_unlock(&head->lock);
+        }
+}
+
 void get_global_private_mem(void **private_mem, uint64_t *private_mem_size)
 {
         if (__hugepage__ == NULL)
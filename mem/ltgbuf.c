@@ -200,6 +200,8 @@ int ltgbuf_copy1(ltgbuf_t *buf, void *src, uint32_t offset, uint32_t len)
 
                 if (left == 0)
                         break;
+
+                sche_maybe_yield();
         }
 
         BUFFER_CHECK(buf);
@@ -253,6 +255,8 @@ int ltgbuf_copy2(void *dst, const ltgbuf_t *buf, uint32_t offset, uint32_t len)
 
                 if (left == 0)
                         break;
+
+                sche_maybe_yield();
         }
 
         BUFFER_CHECK(buf);
@@ -448,6 +452,54 @@ void IO_FUNC ltgbuf_reference(ltgbuf_t *dist, const ltgbuf_t *src)
         BUFFER_CHECK(dist);
 }
 
+/**
+ * append [off, off + len) of src to dist, huge segs are referenced without
+ * copy and stay valid after src is freed, other segs are copied.
+ */
+int IO_FUNC ltgbuf_slice(ltgbuf_t *dist, const ltgbuf_t *src, uint32_t off, uint32_t len)
+{
+        int ret;
+        seg_t *seg, *newseg;
+        struct list_head *pos;
+        uint32_t min;
+
+        BUFFER_CHECK(src);
+        BUFFER_CHECK(dist);
+
+        LTG_ASSERT(off + len <= src->len);
+
+        list_for_each(pos, &src->list) {
+                if (len == 0)
+                        break;
+
+                seg = (seg_t *)pos;
+                if (off >= seg->len) {
+                        off -= seg->len;
+                        continue;
+                }
+
+                min = _min(len, seg->len - off);
+                newseg = seg_huge_slice(dist, seg, off, min);
+                if (likely(newseg)) {
+                        seg_add_tail(dist, newseg);
+                } else {
+                        ret = ltgbuf_appendmem(dist, seg->handler.ptr + off, min);
+                        if (unlikely(ret))
+                                GOTO(err_ret, ret);
+                }
+
+                len -= min;
+                off = 0;
+        }
+
+        LTG_ASSERT(len == 0);
+        BUFFER_CHECK(dist);
+
+        return 0;
+err_ret:
+        return ret;
+}
+
 inline int IO_FUNC ltgbuf_initwith(ltgbuf_t *buf, void *data, int size,
                                     void *arg, int (*cb)(void *arg))
 {
@@ -636,6 +688,8 @@ int ltgbuf_copy(ltgbuf_t *buf, const char *srcmem, int size)
 
                 left -= min;
                 offset += min;
+
+                sche_maybe_yield();
         }
 
         BUFFER_CHECK(buf);
@@ -802,6 +856,8 @@ uint32_t ltgbuf_crc_stream(uint32_t *crcode, const ltgbuf_t *buf,
 
                 if (left == 0)
                         break;
+
+                sche_maybe_yield();
         }
 
         return 0;
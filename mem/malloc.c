@@ -59,12 +59,83 @@ static void __free__(void *mem)
 
 void __ltg_malloc_bind(void *ptr, size_t size)
 {
+        uintptr_t begin, end;
 
         core_t *core = core_self();
         if (core && core->main_core){
-                long unsigned int node_id = core->main_core->node_id;
-                mbind(ptr, size, MPOL_PREFERRED, &node_id, 3, 0);
+                // mbind takes a node mask and whole pages, skip partial ones
+                long unsigned int node_mask = 1UL << core->main_core->node_id;
+                begin = ((uintptr_t)ptr + PAGE_SIZE - 1) & ~((uintptr_t)PAGE_SIZE - 1);
+                end = ((uintptr_t)ptr + size) & ~((uintptr_t)PAGE_SIZE - 1);
+                if (end > begin) {
+                        mbind((void *)begin, end - begin, MPOL_PREFERRED,
+                              &node_mask, sizeof(node_mask) * 8, 0);
+                }
+        }
+}
+
+/**
+ * zeroed, page aligned memory placed on node: the pages are bound (and
+ * moved if the heap reused them) before being faulted in, so it does not
+ * matter which thread touches them first. node < 0 is ltg_malloc.
+ * freed by ltg_free.
+ */
+int ltg_malloc_node(void **_ptr, size_t size, int node)
+{
+        int ret;
+        void *ptr;
+        size_t len;
+        long unsigned int node_mask;
+
+        if (node < 0)
+                return ltg_malloc(_ptr, size);
+
+        len = (size + PAGE_SIZE - 1) & ~((size_t)PAGE_SIZE - 1);
+        ptr = __memalign__(PAGE_SIZE, len);
+        if (ptr == NULL) {
+                ret = ENOMEM;
+                GOTO(err_ret, ret);
+        }
+
+        node_mask = 1UL << node;
+        ret = mbind(ptr, len, MPOL_PREFERRED, &node_mask, sizeof(node_mask) * 8,
+                    MPOL_MF_MOVE);
+        if (unlikely(ret)) {
+                DWARN("mbind %p %ju node %d errno %d\n", ptr, (uint64_t)len,
+                      node, errno);
         }
+
+        memset(ptr, 0x0, len);
+
+        *_ptr = ptr;
+
+        return 0;
+err_ret:
+        return ret;
+}
+
+/**
+ * ltg_malloc_node on the node of the calling core
+ */
+int ltg_malloc_local(void **_ptr, size_t size)
+{
+        core_t *core = core_self();
+
+        return ltg_malloc_node(_ptr, size,
+                               (core && core->main_core) ? core->main_core->node_id : -1);
+}
+
+/**
+ * @return the node backing the page of ptr, -1 if unknown
+ */
+int ltg_mem_node(const void *ptr)
+{
+        int node = -1;
+
+        if (get_mempolicy(&node, NULL, 0, (void *)ptr, MPOL_F_NODE | MPOL_F_ADDR))
+                return -1;
+
+        return node;
 }
 
 int ltg_malign(void **_ptr, size_t align, size_t size)
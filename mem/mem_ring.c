@@ -227,14 +227,13 @@ static void __mem_ring_local_free(mem_handler_t *mem_handler)
         }
 }
 
-static int __cross_free_va(va_list ap)
+static int __cross_free(void *arg)
 {
-        mem_handler_t mem_handler = va_arg(ap, mem_handler_t);
-        va_end(ap);
+        mem_handler_t *mem_handler = arg;
 
-        DBUG("cross free %p %p\n", mem_handler.pool, mem_handler.head);
+        DBUG("cross free %p %p\n", mem_handler->pool, mem_handler->head);
         
-        __mem_ring_local_free(&mem_handler);
+        __mem_ring_local_free(mem_handler);
 
         return 0;
 }
@@ -246,8 +245,8 @@ static void __mem_ring_crossfree(core_t *core, mem_handler_t *mem_handler)
         DBUG("cross free %p %p\n", mem_handler->pool, mem_handler->head);
 
         (void) core;
-        int ret = core_request(head->hash, -1, "mem_ring_deref",
-                               __cross_free_va, *mem_handler);
+        int ret = core_call_async(head->hash, "mem_ring_deref", __cross_free,
+                                  mem_handler, sizeof(*mem_handler));
         LTG_ASSERT(ret == 0);
 }
 
@@ -333,15 +333,13 @@ void IO_FUNC __slab_free_public(slab_t *slab, void *ptr)
         ltg_spin_unlock(&slab->public->spin);
 }
 
-static int __slab_cross_free_va(va_list ap)
+static int __slab_cross_free(void *arg)
 {
-        void *ptr = va_arg(ap, void *);
+        void *ptr = *(void **)arg;
         slab_md_t *md = ptr - SLAB_MD;
 
         LTG_ASSERT(md->slab_bucket->private);
 
-        va_end(ap);
-
         __slab_free_local(ptr);
  
         return 0;
@@ -370,8 +368,8 @@ void IO_FUNC slab_free(slab_t *slab, void *ptr)
                 //LTG_ASSERT(md->magic == array->magic);
                 //LTG_ASSERT(md->slab_bucket->tid == array->tid);
 
-                core_request(md->coreid, -1, "slab_free",
-                             __slab_cross_free_va, ptr);
+                core_call_async(md->coreid, "slab_free",
+                                __slab_cross_free, &ptr, sizeof(ptr));
                 
         }
 }
@@ -52,10 +52,7 @@ static void IO_FUNC __corenet_poller(void *_core, void *var, void *_corenet)
         if (likely(ltgconf_global.rdma && ltgconf_global.daemon)) {
                 corenet_rdma_poll(corenet);
         } else {
-                core_t *core = _core;
-                int tmo = (core->flag & CORE_FLAG_POLLING) ? 0 : 1;
-
-                corenet_tcp_poll(var, tmo);
+                corenet_tcp_poll(var, core_poll_tmo(_core));
         }
 
         return;
@@ -62,7 +62,8 @@ static int __corenet_hb_send(void *_ctx, uint64_t seq)
         int ret;
         hb_ctx_t *ctx = _ctx;
         ctx->seq = seq;
-        ret = core_request(ctx->localid.idx, -1, "hb send", __corenet_hb_send_va, ctx);
+        // top class, bulk work under STRICT must not delay it into a false timeout
+        ret = core_request(ctx->localid.idx, SCHE_GROUP0, "hb send", __corenet_hb_send_va, ctx);
         if (unlikely(ret))
                 GOTO(err_ret, ret);
         
@@ -87,7 +88,7 @@ static int __corenet_hb_close(void *_ctx)
 {
         hb_ctx_t *ctx = _ctx;
 
-        core_request(ctx->localid.idx, -1, "hb close", __corenet_hb_close_va, ctx);
+        core_request(ctx->localid.idx, SCHE_GROUP0, "hb close", __corenet_hb_close_va, ctx);
 
         return 0;
 }
@@ -26,11 +26,37 @@ typedef struct {
         task_t task;
 } wait_t;
 
+typedef struct {
+        corenet_maping_t *entry;
+        uint32_t gen;
+        int idx;
+        int lane;
+} repair_t;
+
 int corenet_hb_add(const coreid_t *coreid, const sockid_t *sockid);
 
 static void __corenet_maping_close_entry(corenet_maping_t *entry,
                                          const sockid_t *_sockid);
 
+static int __corenet_maping_lanes()
+{
+        int lanes = ltgconf_global.tcp_lanes;
+
+        if (ltgconf_global.rdma || lanes <= 1)
+                return 1;
+
+        return lanes < CORENET_LANE_MAX ? lanes : CORENET_LANE_MAX;
+}
+
+static inline sockid_t *__corenet_maping_sock(corenet_maping_t *entry,
+                                              int idx, int lane)
+{
+        if (lane == 0)
+                return &entry->sockid[idx];
+
+        return &entry->lane[(lane - 1) * CORE_MAX + idx];
+}
+
 static  corenet_maping_t *__corenet_maping_get__()
 {
         return core_tls_get(NULL, VARIABLE_MAPING);
@@ -92,7 +118,7 @@ void corenet_maping_resume(core_t *core, const nid_t *nid, int res)
         arg->nid = *nid;
         arg->res = res;
 
-        ret = sche_request(core->sche, -1, __corenet_maping_resume, arg, "corenet_resume");
+        ret = sche_request_wait(core->sche, -1, __corenet_maping_resume, arg, "corenet_resume");
         if (unlikely(ret))
                 UNIMPLEMENTED(__DUMP__);
 }
@@ -227,14 +253,19 @@ err_ret:
 }
 
 
+/*
+ * _sockid holds lanes * CORE_MAX, lane major. a bulk lane that fails here
+ * is left at sd -1 and repaired on demand, only lane 0 must connect.
+ */
 static int __corenet_maping_connect__(const nid_t *nid, sockid_t *_sockid,
-                                      uint64_t *_coremask)
+                                      int lanes, uint64_t *_coremask)
 {
         int ret, valuelen;
         char buf[MAX_BUF_LEN], key[MAX_NAME_LEN];
         corenet_addr_t *addr = (void *)buf;
         uint64_t coremask;
         coreid_t coreid = {*nid, 0};
+        sockid_t *sockid;
 
         snprintf(key, MAX_NAME_LEN, "%d/coremask", nid->id);
         valuelen = sizeof(coremask);
@@ -261,6 +292,16 @@ static int __corenet_maping_connect__(const nid_t *nid, sockid_t *_sockid,
                 }
 
                 count++;
+
+                for (int j = 1; j < lanes; j++) {
+                        sockid = &_sockid[j * CORE_MAX + i];
+                        ret = __corenet_maping_connect_core(&coreid, addr, sockid);
+                        if (unlikely(ret)) {
+                                DWARN("connect to %s/%d lane %d fail\n",
+                                      netable_rname(nid), i, j);
+                                sockid->sd = -1;
+                        }
+                }
         }
 
         *_coremask = coremask;
@@ -280,13 +321,27 @@ err_ret:
 }
 
 STATIC int __corenet_maping_update(const nid_t *nid, const sockid_t *_sockid,
-                                   uint64_t coremask)
+                                   int lanes, uint64_t coremask)
 {
         int ret;
         corenet_maping_t *entry;
         coreid_t coreid = {*nid, 0};
+        sockid_t *lane;
 
         entry = &__corenet_maping_get__()[nid->id];
+
+        if (lanes > 1 && entry->lane == NULL) {
+                ret = ltg_malloc((void **)&lane,
+                                 sizeof(*lane) * CORE_MAX * (lanes - 1));
+                if (unlikely(ret))
+                        GOTO(err_ret, ret);
+
+                for (int i = 0; i < CORE_MAX * (lanes - 1); i++) {
+                        lane[i].sd = -1;
+                }
+
+                entry->lane = lane;
+        }
         
         ret = ltg_spin_lock(&entry->lock);
         if (unlikely(ret))
@@ -308,21 +363,36 @@ STATIC int __corenet_maping_update(const nid_t *nid, const sockid_t *_sockid,
                 if (!core_usedby(coremask, i))
                         continue;
                         
-                if (entry->connected(&entry->sockid[i])) {
-                        DERROR("%s[%d] connected, restart for safe\n",
-                               netable_rname(nid), i);
-                        EXIT(EAGAIN);
+                for (int j = 0; j < entry->lanes; j++) {
+                        if (entry->connected(__corenet_maping_sock(entry, i, j))) {
+                                DERROR("%s[%d] lane %d connected, restart for safe\n",
+                                       netable_rname(nid), i, j);
+                                EXIT(EAGAIN);
+                        }
                 }
 
                 coreid.idx = i;
-                sockid_t sockid = _sockid[i];
-                sockid.request = entry->request;
-                ret = corenet_hb_add(&coreid, &sockid);
-                if (unlikely(ret))
-                        UNIMPLEMENTED(__DUMP__);
+                for (int j = 0; j < lanes; j++) {
+                        sockid_t sockid = _sockid[j * CORE_MAX + i];
+                        if (sockid.sd == -1)
+                                continue;
+
+                        sockid.request = entry->request;
+                        ret = corenet_hb_add(&coreid, &sockid);
+                        if (unlikely(ret))
+                                UNIMPLEMENTED(__DUMP__);
+                }
         }
 
         memcpy(entry->sockid, _sockid, sizeof(*_sockid) * CORE_MAX);
+        if (lanes > 1) {
+                memcpy(entry->lane, &_sockid[CORE_MAX],
+                       sizeof(*_sockid) * CORE_MAX * (lanes - 1));
+        }
+
+        memset(entry->repair, 0x00, sizeof(entry->repair));
+        entry->lanes = lanes;
+        entry->gen++;
         entry->loading = 0;
         entry->coremask = coremask;
 
@@ -337,20 +407,27 @@ err_ret:
 
 STATIC int __corenet_maping_connect(const nid_t *nid)
 {
-        int ret;
-        sockid_t sockid[CORE_MAX];
+        int ret, lanes;
+        sockid_t *sockid;
         core_t *core = core_self();
         uint64_t coremask;
 
-        memset(sockid, 0x00, sizeof(sockid_t) * CORE_MAX);
-        ret = __corenet_maping_connect__(nid, sockid, &coremask);
+        lanes = __corenet_maping_lanes();
+        ret = ltg_malloc((void **)&sockid, sizeof(sockid_t) * CORE_MAX * lanes);
         if (unlikely(ret))
                 GOTO(err_ret, ret);
 
-        ret = __corenet_maping_update(nid, sockid, coremask);
+        memset(sockid, 0x00, sizeof(sockid_t) * CORE_MAX * lanes);
+        ret = __corenet_maping_connect__(nid, sockid, lanes, &coremask);
+        if (unlikely(ret))
+                GOTO(err_free, ret);
+
+        ret = __corenet_maping_update(nid, sockid, lanes, coremask);
         if (unlikely(ret))
                 UNIMPLEMENTED(__DUMP__);
 
+err_free:
+        ltg_free((void **)&sockid);
 err_ret:
         corenet_maping_resume(core, nid, ret);
         return ret;
@@ -375,11 +452,149 @@ err_ret:
         return ret;
 }
 
+static void __corenet_maping_repair_task(void *_arg)
+{
+        int ret, valuelen;
+        repair_t *repair = _arg;
+        corenet_maping_t *entry = repair->entry;
+        coreid_t coreid = {entry->nid, repair->idx};
+        char buf[MAX_BUF_LEN], key[MAX_NAME_LEN];
+        corenet_addr_t *addr = (void *)buf;
+        sockid_t sockid, *old;
+
+        ret = ltg_spin_lock(&entry->lock);
+        if (unlikely(ret))
+                UNIMPLEMENTED(__DUMP__);
+
+        if (entry->gen != repair->gen || entry->loading) {
+                ltg_spin_unlock(&entry->lock);
+                ret = ESTALE;
+                GOTO(err_ret, ret);
+        }
+
+        old = __corenet_maping_sock(entry, repair->idx, repair->lane);
+        if (old->sd != -1) {
+                __corenet_maping_close_finally__(&entry->nid, old);
+                old->sd = -1;
+        }
+
+        ltg_spin_unlock(&entry->lock);
+
+        valuelen = MAX_NAME_LEN;
+        snprintf(key, MAX_NAME_LEN, "%d/%d", entry->nid.id, repair->idx);
+        ret = etcd_get_bin(ETCD_CORENET, key, (void *)addr, &valuelen, NULL);
+        if (unlikely(ret))
+                GOTO(err_ret, ret);
+
+        ret = __corenet_maping_connect_core(&coreid, addr, &sockid);
+        if (unlikely(ret))
+                GOTO(err_ret, ret);
+
+        ret = ltg_spin_lock(&entry->lock);
+        if (unlikely(ret))
+                UNIMPLEMENTED(__DUMP__);
+
+        if (entry->gen != repair->gen || entry->loading) {
+                ltg_spin_unlock(&entry->lock);
+
+                DINFO("%s/%d lane %d reconnected meanwhile, drop\n",
+                      netable_rname(&entry->nid), repair->idx, repair->lane);
+                __corenet_maping_close_finally__(&entry->nid, &sockid);
+                ltg_free((void **)&repair);
+                return;
+        }
+
+        old = __corenet_maping_sock(entry, repair->idx, repair->lane);
+        *old = sockid;
+        sockid.request = entry->request;
+        ret = corenet_hb_add(&coreid, &sockid);
+        if (unlikely(ret))
+                UNIMPLEMENTED(__DUMP__);
+
+        entry->repair[repair->idx] &= ~(1 << repair->lane);
+
+        ltg_spin_unlock(&entry->lock);
+
+        DINFO("%s/%d lane %d repaired, sd %u\n", netable_rname(&entry->nid),
+              repair->idx, repair->lane, sockid.sd);
+        ltg_free((void **)&repair);
+        return;
+err_ret:
+        ret = ltg_spin_lock(&entry->lock);
+        if (unlikely(ret))
+                UNIMPLEMENTED(__DUMP__);
+
+        if (entry->gen == repair->gen)
+                entry->repair[repair->idx] &= ~(1 << repair->lane);
+
+        ltg_spin_unlock(&entry->lock);
+
+        DWARN("%s/%d lane %d repair fail\n", netable_rname(&entry->nid),
+              repair->idx, repair->lane);
+        ltg_free((void **)&repair);
+}
+
+/*
+ * reconnect one lane in the background, the other lanes of the core keep
+ * serving meanwhile.
+ */
+static void __corenet_maping_repair(corenet_maping_t *entry, int idx, int lane)
+{
+        int ret;
+        repair_t *repair;
+
+        ret = ltg_spin_lock(&entry->lock);
+        if (unlikely(ret))
+                UNIMPLEMENTED(__DUMP__);
+
+        if (entry->repair[idx] & (1 << lane)) {
+                ltg_spin_unlock(&entry->lock);
+                return;
+        }
+
+        ret = ltg_malloc((void **)&repair, sizeof(*repair));
+        if (unlikely(ret)) {
+                ltg_spin_unlock(&entry->lock);
+                return;
+        }
+
+        entry->repair[idx] |= (1 << lane);
+        repair->entry = entry;
+        repair->gen = entry->gen;
+        repair->idx = idx;
+        repair->lane = lane;
+
+        ltg_spin_unlock(&entry->lock);
+
+        DINFO("%s/%d lane %d lost, repair\n", netable_rname(&entry->nid),
+              idx, lane);
+        sche_task_new("corenet_lane", __corenet_maping_repair_task, repair, -1);
+}
+
+/*
+ * lane 0 carries small rpc, bulk transfers rotate over the other lanes so
+ * they do not queue ahead of small ones in the same socket.
+ */
+static inline int __corenet_maping_lane(corenet_maping_t *entry, int size)
+{
+        int bulk;
+
+        if (likely(entry->lanes == 1))
+                return 0;
+
+        bulk = ltgconf_global.tcp_lane_bulk ? ltgconf_global.tcp_lane_bulk
+                : CORENET_LANE_BULK;
+        if (size < bulk)
+                return 0;
+
+        return 1 + entry->cursor++ % (entry->lanes - 1);
+}
+
 static int IO_FUNC __corenet_maping_get(const coreid_t *coreid,
                                         corenet_maping_t *entry,
-                                        sockid_t *_sockid)
+                                        int size, sockid_t *_sockid)
 {
-        int ret;
+        int ret, lane;
         sockid_t *sockid;
 
         if (unlikely(entry->connected == NULL)) {
@@ -388,16 +603,27 @@ static int IO_FUNC __corenet_maping_get(const coreid_t *coreid,
         }
         
         LTG_ASSERT((int)coreid->idx < (int)CORE_MAX);
-        sockid = &entry->sockid[coreid->idx];
+        lane = __corenet_maping_lane(entry, size);
+        sockid = __corenet_maping_sock(entry, coreid->idx, lane);
 
         if (likely(entry->connected(sockid))) {
                 *_sockid = *sockid;
-        } else {
-                ret = ENONET;
-                GOTO(err_ret, ret);
+                return 0;
         }
 
-        return 0;
+        /* lane down, borrow a live one of the same core until repaired */
+        for (int i = 1; i < entry->lanes; i++) {
+                sockid = __corenet_maping_sock(entry, coreid->idx,
+                                               (lane + i) % entry->lanes);
+                if (entry->connected(sockid)) {
+                        __corenet_maping_repair(entry, coreid->idx, lane);
+                        *_sockid = *sockid;
+                        return 0;
+                }
+        }
+
+        ret = ENONET;
+        GOTO(err_ret, ret);
 err_ret:
         return ret;
 }
@@ -408,6 +634,15 @@ static void __corenet_maping_connect_task(void *arg)
         corenet_maping_t *entry = arg;
         const nid_t *nid = &entry->nid;
 
+        /* lane repairs still in flight belong to the old connections */
+        ret = ltg_spin_lock(&entry->lock);
+        if (unlikely(ret))
+                UNIMPLEMENTED(__DUMP__);
+
+        entry->gen++;
+
+        ltg_spin_unlock(&entry->lock);
+
         __corenet_maping_close_entry(entry, NULL);
         
         DINFO("connect to %s\n", netable_rname(nid));
@@ -456,7 +691,8 @@ err_ret:
         return ret;
 }
 
-int IO_FUNC corenet_maping(void *core, const coreid_t *coreid, sockid_t *sockid)
+int IO_FUNC corenet_maping(void *core, const coreid_t *coreid, int size,
+                           sockid_t *sockid)
 {
         int ret;
         corenet_maping_t *entry;
@@ -466,7 +702,7 @@ retry:
         entry = &__corenet_maping_get_byctx(core)[coreid->nid.id];
         LTG_ASSERT(entry);
 
-        ret = __corenet_maping_get(coreid, entry, sockid);
+        ret = __corenet_maping_get(coreid, entry, size, sockid);
         if (unlikely(ret)) {
                 /**
                  * 保证过程唯一性，只有一个task发起连接，其它并发task等待连接完成
@@ -498,34 +734,36 @@ static void __corenet_maping_close_entry(corenet_maping_t *entry,
                 if (!core_usedby(entry->coremask, i))
                         continue;
 
-                sockid = &entry->sockid[i];
-                if (sockid->sd == -1) {
-                        continue;
-                }
-
-                if (_sockid == NULL) {
-                        DINFO("close all sock %s nid[%u], sockid %u\n",
-                              netable_rname(&entry->nid), entry->nid.id,
-                              sockid->sd);
+                for (int j = 0; j < entry->lanes; j++) {
+                        sockid = __corenet_maping_sock(entry, i, j);
+                        if (sockid->sd == -1) {
+                                continue;
+                        }
 
-                        __corenet_maping_close_finally__(&entry->nid, sockid);
-                        sockid->sd = -1;
-                        continue;
-                }
+                        if (_sockid == NULL) {
+                                DINFO("close all sock %s nid[%u], sockid %u\n",
+                                      netable_rname(&entry->nid), entry->nid.id,
+                                      sockid->sd);
 
-                if (_sockid->sd == sockid->sd
-                    && _sockid->seq == sockid->seq) {
-                        DBUG("close one sock %s nid[%u], sockid %u\n",
-                              netable_rname(&entry->nid), entry->nid.id,
-                              sockid->sd);
+                                __corenet_maping_close_finally__(&entry->nid, sockid);
+                                sockid->sd = -1;
+                                continue;
+                        }
 
-                        __corenet_maping_close_finally__(&entry->nid, sockid);
-                        sockid->sd = -1;
-                        break;
-                } else {
-                        DBUG("skip close %s nid[%u], sockid %u\n",
-                              netable_rname(&entry->nid), entry->nid.id,
-                              sockid->sd);
+                        if (_sockid->sd == sockid->sd
+                            && _sockid->seq == sockid->seq) {
+                                DBUG("close one sock %s nid[%u], sockid %u lane %d\n",
+                                     netable_rname(&entry->nid), entry->nid.id,
+                                     sockid->sd, j);
+
+                                __corenet_maping_close_finally__(&entry->nid, sockid);
+                                sockid->sd = -1;
+                                return;
+                        } else {
+                                DBUG("skip close %s nid[%u], sockid %u\n",
+                                     netable_rname(&entry->nid), entry->nid.id,
+                                     sockid->sd);
+                        }
                 }
         }
 }
@@ -536,7 +774,7 @@ static int __corenet_maping_init__(corenet_maping_t **_maping)
         corenet_maping_t *maping, *entry;
         nid_t nid;
 
-        ret = ltg_malloc((void **)&maping, sizeof(*maping) *  NODEID_MAX);
+        ret = ltg_malloc_local((void **)&maping, sizeof(*maping) *  NODEID_MAX);
         if (unlikely(ret))
                 GOTO(err_ret, ret);
 
@@ -551,6 +789,11 @@ static int __corenet_maping_init__(corenet_maping_t **_maping)
                 entry->loading = 0;
                 entry->coremask = 0;
                 entry->nid = nid;
+                entry->lane = NULL;
+                entry->lanes = 1;
+                entry->cursor = 0;
+                entry->gen = 0;
+                memset(entry->repair, 0x00, sizeof(entry->repair));
         }
 
         core_tls_set(VARIABLE_MAPING, maping);
@@ -586,8 +829,8 @@ STATIC int __corenet_maping_close(void *_core, void *_opaque)
 
         *arg = *_arg;
 
-        ret = sche_request(core->sche, -1, __corenet_maping_close__,
-                           arg, "corenet_close");
+        ret = sche_request_wait(core->sche, -1, __corenet_maping_close__,
+                                arg, "corenet_close");
         if (unlikely(ret))
                 UNIMPLEMENTED(__DUMP__);
 
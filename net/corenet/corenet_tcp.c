@@ -6,6 +6,9 @@
 #include <pthread.h>
 #include <signal.h>
 #include <netinet/tcp.h>
+#include <poll.h>
+#include <linux/io_uring.h>
+#include <linux/errqueue.h>
 #include <errno.h>
 
 #define DBG_SUBSYS S_LTG_NET
@@ -35,6 +38,13 @@ static int __corenet_tcp_remote(int fd, ltgbuf_t *buf, int op);
 static int __corenet_add(corenet_tcp_t *corenet, const sockid_t *sockid, void *ctx,
                          core_exec exec, func_t reset, func_t check, func_t recv, const char *name);
 
+#if !ENABLE_TCP_THREAD
+static void __corenet_tcp_zerocopy_init(corenet_tcp_t *__corenet__, corenet_node_t *node);
+static void __corenet_tcp_zerocopy_free(corenet_node_t *node);
+static void __corenet_tcp_recv_win_free(corenet_tcp_t *__corenet__,
+                                        corenet_node_t *node);
+#endif
+
 static void IO_FUNC *__corenet_get()
 {
         return core_tls_get(NULL, VARIABLE_CORENET_TCP);
@@ -124,6 +134,27 @@ static void __corenet_checklist_del(corenet_tcp_t *corenet, corenet_node_t *node
 }
 
 
+static void __corenet_tcp_stat(corenet_tcp_t *__corenet__)
+{
+        uint64_t msg, write, byte, hold;
+
+        msg = __corenet__->c_msg - __corenet__->last_msg;
+        write = __corenet__->c_write - __corenet__->last_write;
+        byte = __corenet__->c_byte - __corenet__->last_byte;
+        hold = __corenet__->c_hold - __corenet__->last_hold;
+        if (msg == 0)
+                return;
+
+        // write per 100 msg, below 100 is coalescing
+        DINFO("corenet tcp msg:%ju write:%ju write/msg:%ju%% avg_write:%ju hold:%ju\n",
+              msg, write, write * 100 / msg, write ? byte / write : 0, hold);
+
+        __corenet__->last_msg = __corenet__->c_msg;
+        __corenet__->last_write = __corenet__->c_write;
+        __corenet__->last_byte = __corenet__->c_byte;
+        __corenet__->last_hold = __corenet__->c_hold;
+}
+
 static void __corenet_check_interval()
 {
         int ret;
@@ -141,6 +172,8 @@ static void __corenet_check_interval()
 
         DBUG("corenet check\n");
 
+        __corenet_tcp_stat(__corenet__);
+
         ret = ltg_spin_lock(&__corenet__->corenet.lock);
         if (unlikely(ret))
                 UNIMPLEMENTED(__DUMP__);
@@ -158,6 +191,334 @@ void corenet_tcp_check()
         __corenet_check_interval();
 }
 
+#if !ENABLE_TCP_THREAD
+
+/*
+ * io_uring backend, user_data is seq:32 sd:28 op:4 so completions of a
+ * closed connection are told apart from the next one on the same fd
+ */
+
+#define CORENET_URING_RECV 0x1
+#define CORENET_URING_POLL 0x2
+#define CORENET_URING_SEND 0x4
+#define CORENET_URING_CANCEL 0x8
+
+#define CORENET_URING_DATA(__node__, __op__)                            \
+        (((uint64_t)(__node__)->sockid.seq << 32)                       \
+         | ((uint64_t)(__node__)->sockid.sd << 4) | (__op__))
+
+typedef struct {
+        struct msghdr msg;
+        struct iovec iov[CORENET_URING_IOV];
+        ltgbuf_t buf;           // bytes of the sendmsg in flight
+} corenet_uring_send_t;
+
+static int __corenet_uring_arm(corenet_tcp_t *__corenet__, corenet_node_t *node)
+{
+        struct io_uring_sqe *sqe;
+
+        sqe = corenet_uring_sqe(__corenet__->uring);
+        if (unlikely(sqe == NULL))
+                return ENOSPC;
+
+        sqe->fd = node->sockid.sd;
+        if (node->recv) {
+                // __core_interrupt_eventfd_func, oneshot keeps it level triggered
+                sqe->opcode = IORING_OP_POLL_ADD;
+                sqe->poll32_events = POLLIN;
+                sqe->user_data = CORENET_URING_DATA(node, CORENET_URING_POLL);
+        } else {
+                sqe->opcode = IORING_OP_RECV;
+                sqe->ioprio = IORING_RECV_MULTISHOT;
+                sqe->flags = IOSQE_BUFFER_SELECT;
+                sqe->buf_group = CORENET_URING_BGID;
+                sqe->user_data = CORENET_URING_DATA(node, CORENET_URING_RECV);
+        }
+
+        return 0;
+}
+
+static void __corenet_uring_arm_retry(corenet_tcp_t *__corenet__, corenet_node_t *node)
+{
+        // sq full, corenet_tcp_commit arms it next round
+        if (list_empty(&node->uring_arm)) {
+                DWARN("sd %u sq full, arm later\n", node->sockid.sd);
+                list_add_tail(&node->uring_arm, &__corenet__->uring_arm);
+        }
+}
+
+static void __corenet_uring_arm_pending(corenet_tcp_t *__corenet__)
+{
+        int ret;
+        corenet_node_t *node;
+
+        while (!list_empty(&__corenet__->uring_arm)) {
+                node = list_entry(__corenet__->uring_arm.next, corenet_node_t,
+                                  uring_arm);
+                ret = __corenet_uring_arm(__corenet__, node);
+                if (unlikely(ret))
+                        break;
+
+                list_del_init(&node->uring_arm);
+        }
+}
+
+static void __corenet_uring_cancel(corenet_tcp_t *__corenet__, corenet_node_t *node)
+{
+        int i, op[2], count = 0;
+        struct io_uring_sqe *sqe;
+
+        // the kernel holds the file until its requests are gone, close(2) is not enough
+        op[count++] = node->recv ? CORENET_URING_POLL : CORENET_URING_RECV;
+        if (node->uring & CORENET_URING_SEND)
+                op[count++] = CORENET_URING_SEND;
+
+        for (i = 0; i < count; i++) {
+                sqe = corenet_uring_sqe(__corenet__->uring);
+                if (unlikely(sqe == NULL)) {
+                        DWARN("sd %u cancel fail\n", node->sockid.sd);
+                        continue;
+                }
+
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->fd = -1;
+                sqe->addr = CORENET_URING_DATA(node, op[i]);
+                sqe->user_data = CORENET_URING_DATA(node, CORENET_URING_CANCEL);
+        }
+}
+
+/*
+ * one sendmsg per connection in flight, whatever is queued meanwhile waits
+ * in send_buf for the completion
+ */
+static int __corenet_uring_send(corenet_tcp_t *__corenet__, corenet_node_t *node)
+{
+        int ret, iov_count;
+        struct io_uring_sqe *sqe;
+        corenet_uring_send_t *send = node->uring_send;
+
+        LTG_ASSERT(!(node->uring & CORENET_URING_SEND));
+
+        if (unlikely(send == NULL)) {
+                // kept for the fd slot, a closed connection may still own it
+                ret = ltg_malloc((void **)&send, sizeof(*send));
+                if (unlikely(ret))
+                        GOTO(err_ret, ret);
+
+                ltgbuf_init(&send->buf, 0);
+                node->uring_send = send;
+        }
+
+        sqe = corenet_uring_sqe(__corenet__->uring);
+        if (unlikely(sqe == NULL)) {
+                ret = ENOSPC;
+                GOTO(err_ret, ret);
+        }
+
+        LTG_ASSERT(send->buf.len == 0);
+        ltgbuf_merge(&send->buf, &node->send_buf);
+
+        iov_count = CORENET_URING_IOV;
+        ltgbuf_trans(send->iov, &iov_count, &send->buf);
+
+        memset(&send->msg, 0x0, sizeof(send->msg));
+        send->msg.msg_iov = send->iov;
+        send->msg.msg_iovlen = iov_count;
+
+        TRACE(TRACE_NET_SEND, node->sockid.sd, send->buf.len, NULL);
+        __corenet__->c_write++;
+        __corenet__->c_byte += send->buf.len;
+
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = node->sockid.sd;
+        sqe->addr = (uint64_t)&send->msg;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = CORENET_URING_DATA(node, CORENET_URING_SEND);
+
+        node->uring |= CORENET_URING_SEND;
+
+        return 0;
+err_ret:
+        return ret;
+}
+
+static void __corenet_uring_send_retry(corenet_tcp_t *__corenet__, corenet_node_t *node)
+{
+        // sq full, corenet_tcp_commit picks it up next round
+        if (list_empty(&node->send_list)) {
+                list_add_tail(&node->send_list, &__corenet__->corenet.forward_list);
+        }
+}
+
+static void __corenet_uring_send_done(corenet_tcp_t *__corenet__, corenet_node_t *node,
+                                      uint32_t seq, int res)
+{
+        int ret;
+        sockid_t sockid = node->sockid;
+        corenet_uring_send_t *send = node->uring_send;
+
+        LTG_ASSERT(node->uring & CORENET_URING_SEND);
+        node->uring &= ~CORENET_URING_SEND;
+
+        if (node->sockid.sd == -1 || node->sockid.seq != seq) {
+                DBUG("sd %u seq %u closed\n", node->sockid.sd, seq);
+                ltgbuf_free(&send->buf);
+                if (node->sockid.sd == -1 || node->send_buf.len == 0)
+                        return;
+        } else if (res < 0) {
+                ltgbuf_free(&send->buf);
+                ret = -res;
+                DWARN("forward to %s @ %u fail ret %d\n",
+                      _inet_ntoa(node->sockid.addr), node->sockid.sd, ret);
+                GOTO(err_close, ret);
+        } else {
+                ltgbuf_pop(&send->buf, NULL, res);
+                if (send->buf.len) {
+                        // short send, the rest goes ahead of what came since
+                        ltgbuf_merge(&send->buf, &node->send_buf);
+                        ltgbuf_merge(&node->send_buf, &send->buf);
+                }
+
+                if (node->send_buf.len == 0)
+                        return;
+        }
+
+        ret = __corenet_uring_send(__corenet__, node);
+        if (unlikely(ret)) {
+                if (ret == ENOSPC) {
+                        __corenet_uring_send_retry(__corenet__, node);
+                } else {
+                        GOTO(err_close, ret);
+                }
+        }
+
+        return;
+err_close:
+        corenet_tcp_close(&sockid);
+}
+
+static void __corenet_uring_exec_recv(void *_node)
+{
+        int ret, count;
+        corenet_node_t *node = _node;
+        sockid_t sockid = node->sockid;
+
+        // closed before the task ran
+        if (unlikely(sockid.sd == -1))
+                return;
+
+        // __iscsi_newtask_core
+        // corerpc_recv
+        ret = node->exec(node->ctx, &node->recv_buf, &count);
+        if (unlikely(ret))
+                GOTO(err_ret, ret);
+
+        return;
+err_ret:
+        corenet_tcp_close(&sockid);
+}
+
+static void __corenet_uring_exec_poll(void *_node)
+{
+        corenet_node_t *node = _node;
+
+        if (unlikely(node->sockid.sd == -1))
+                return;
+
+        // __core_interrupt_eventfd_func
+        // __core_aio_eventfd_func
+        node->recv(node->ctx);
+}
+
+static void IO_FUNC __corenet_uring_cqe(void *ctx, const struct io_uring_cqe *cqe)
+{
+        int ret, op, sd, bid = -1;
+        uint32_t seq;
+        sockid_t sockid;
+        corenet_node_t *node;
+        corenet_tcp_t *__corenet__ = ctx;
+
+        op = cqe->user_data & 0xf;
+        sd = (cqe->user_data >> 4) & 0xfffffff;
+        seq = cqe->user_data >> 32;
+        if (cqe->flags & IORING_CQE_F_BUFFER)
+                bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+        node = &__corenet__->array[sd];
+        sockid = node->sockid;
+
+        if (op == CORENET_URING_SEND) {
+                __corenet_uring_send_done(__corenet__, node, seq, cqe->res);
+                return;
+        }
+
+        if (op == CORENET_URING_CANCEL
+            || node->sockid.sd == -1 || node->sockid.seq != seq) {
+                DBUG("sd %u seq %u op %u res %d closed\n", sd, seq, op, cqe->res);
+                if (bid != -1)
+                        corenet_uring_buf_put(__corenet__->uring, bid);
+
+                return;
+        }
+
+        if (op == CORENET_URING_POLL) {
+                if (unlikely(cqe->res < 0)) {
+                        ret = -cqe->res;
+                        GOTO(err_close, ret);
+                }
+
+                sche_task_new("corenet_tcp_recv", __corenet_uring_exec_poll, node, -1);
+        } else {
+                LTG_ASSERT(op == CORENET_URING_RECV);
+
+                if (likely(cqe->res > 0)) {
+                        LTG_ASSERT(bid != -1);
+                        TRACE(TRACE_NET_RECV, sd, cqe->res, NULL);
+
+                        ret = corenet_uring_buf_take(__corenet__->uring, bid,
+                                                     cqe->res, &node->recv_buf);
+                        if (unlikely(ret))
+                                GOTO(err_close, ret);
+
+                        if (node->nonblock) {
+                                sche_task_inline("corenet_tcp_recv",
+                                                 __corenet_uring_exec_recv, node);
+                        } else {
+                                sche_task_new("corenet_tcp_recv",
+                                              __corenet_uring_exec_recv, node, -1);
+                        }
+                } else {
+                        if (bid != -1)
+                                corenet_uring_buf_put(__corenet__->uring, bid);
+
+                        if (cqe->res == 0) {
+                                ret = ECONNRESET;
+                                GOTO(err_close, ret);
+                        } else if (cqe->res != -ENOBUFS) {
+                                ret = -cqe->res;
+                                GOTO(err_close, ret);
+                        }
+
+                        DBUG("sd %u no buffer\n", sd);
+                }
+        }
+
+        // multishot ended or oneshot poll fired, arm again unless closed meanwhile
+        if (!(cqe->flags & IORING_CQE_F_MORE)
+            && node->sockid.sd != -1 && node->sockid.seq == seq) {
+                ret = __corenet_uring_arm(__corenet__, node);
+                if (unlikely(ret))
+                        __corenet_uring_arm_retry(__corenet__, node);
+        }
+
+        return;
+err_close:
+        DBUG("sd %u op %u %s\n", sd, op, strerror(ret));
+        corenet_tcp_close(&sockid);
+}
+
+#endif
+
 static int __corenet_add(corenet_tcp_t *corenet, const sockid_t *sockid, void *ctx,
                          core_exec exec, func_t reset, func_t check, func_t recv,
                          const char *name)
@@ -194,6 +555,17 @@ static int __corenet_add(corenet_tcp_t *corenet, const sockid_t *sockid, void *c
         node->recv = recv;
         node->check = check;
         node->sockid = *sockid;
+        node->nonblock = (recv == NULL && exec == corerpc_recv);
+
+        if (recv == NULL && ltgconf_global.tcp_flush_bytes
+            && ltgconf_global.tcp_flush_delay) {
+                node->flush_bytes = ltgconf_global.tcp_flush_bytes;
+                node->flush_delay = (uint64_t)ltgconf_global.tcp_flush_delay
+                        * sche->hz / (1000 * 1000);
+        } else {
+                node->flush_bytes = 0;
+                node->flush_delay = 0;
+        }
 
         LTG_ASSERT(node->name == NULL);
         ret = ltg_malloc((void **)&node->name, strlen(name) + 1);
@@ -202,6 +574,20 @@ static int __corenet_add(corenet_tcp_t *corenet, const sockid_t *sockid, void *c
         
         strcpy(node->name, name);
 
+#if !ENABLE_TCP_THREAD
+        __corenet_tcp_zerocopy_init(corenet, node);
+
+        if (corenet->uring) {
+                (void) ev;
+                ret = __corenet_uring_arm(corenet, node);
+                if (unlikely(ret)) {
+                        __corenet_uring_arm_retry(corenet, node);
+                }
+
+                goto out;
+        }
+#endif
+
         ev.data.fd = sd;
         ev.events = event;
         ret = epoll_ctl(corenet->corenet.epoll_fd, EPOLL_CTL_ADD, sd, &ev);
@@ -211,6 +597,10 @@ static int __corenet_add(corenet_tcp_t *corenet, const sockid_t *sockid, void *c
                 UNIMPLEMENTED(__DUMP__);//remove checklist
         }
 
+#if !ENABLE_TCP_THREAD
+out:
+#endif
+
         DBUG("corenet_tcp connect %s[%u] %s sd %d, ev %o:%o\n", sche->name,
              sche->id, node->name, sd, node->ev, event);
 
@@ -271,6 +661,10 @@ int corenet_tcp_attach(int coreid, const sockid_t *sockid, void *ctx,
 
         LTG_ASSERT(sockid->type == SOCKID_CORENET);
 
+        if (coreid == CORE_ANY) {
+                coreid = core_balance(core_mask());
+        }
+
         ret = core_request(coreid, -1, "tcp attach", __corenet_tcp_attach,
                            sockid, ctx, exec, reset, check, recv, name);
         if (ret)
@@ -308,6 +702,16 @@ static void __corenet_close__(const sockid_t *sockid)
               sche->id, node->name, sd, node->ev);
         LTG_ASSERT(node->ev);
 
+#if !ENABLE_TCP_THREAD
+        if (__corenet__->uring) {
+                (void) ev;
+                if (!list_empty(&node->uring_arm)) {
+                        list_del_init(&node->uring_arm);
+                }
+
+                __corenet_uring_cancel(__corenet__, node);
+        } else
+#endif
         if (node->ev) {
                 ev.data.fd = sd;
                 ev.events = node->ev;
@@ -323,9 +727,21 @@ static void __corenet_close__(const sockid_t *sockid)
 
         corerpc_reset(&node->sockid);
 
+#if !ENABLE_TCP_THREAD
+        __corenet_tcp_zerocopy_free(node);
+#endif
         close(node->sockid.sd);
         ltgbuf_free(&node->recv_buf);
+#if !ENABLE_TCP_THREAD
+        __corenet_tcp_recv_win_free(__corenet__, node);
+#else
+        ltgbuf_free(&node->recv_win);
+#endif
         ltgbuf_free(&node->send_buf);
+        ltgbuf_free(&node->queue_buf);
+        if (!list_empty(&node->send_list)) {
+                list_del_init(&node->send_list);
+        }
 
         if (!list_empty(&node->hook)) {
                 __corenet_checklist_del(__corenet__, node);
@@ -385,7 +801,7 @@ void corenet_tcp_close(const sockid_t *_sockid)
 }
 
 #if !ENABLE_TCP_THREAD
-static int __corenet_tcp_local(int fd, ltgbuf_t *buf, int op)
+static int __corenet_tcp_local(int fd, ltgbuf_t *buf, int op, int flags)
 {
         int ret, iov_count;
         struct msghdr msg;
@@ -398,6 +814,10 @@ static int __corenet_tcp_local(int fd, ltgbuf_t *buf, int op)
         //LTG_ASSERT(ret == (int)buf->len);
         if(unlikely(ret != (int)buf->len)) {
                 DBUG("for bug test tcp send %d, buf->len:%u\n", ret, buf->len);
+
+                // the rest follows right away, cork this part
+                if (op == __OP_SEND__)
+                        flags |= MSG_MORE;
         }
 
         memset(&msg, 0x0, sizeof(msg));
@@ -405,7 +825,11 @@ static int __corenet_tcp_local(int fd, ltgbuf_t *buf, int op)
         msg.msg_iovlen = iov_count;
 
         if (op == __OP_SEND__) {
-                ret = _sendmsg(fd, &msg, MSG_DONTWAIT);
+                ret = _sendmsg(fd, &msg, MSG_DONTWAIT | flags);
+                if (likely(ret > 0)) {
+                        __corenet__->c_write++;
+                        __corenet__->c_byte += ret;
+                }
         } else if (op == __OP_RECV__) {
                 ret = _recvmsg(fd, &msg, MSG_DONTWAIT);
         } else {
@@ -428,6 +852,7 @@ err_ret:
 }
 #endif
 
+#if ENABLE_TCP_THREAD
 static int __corenet_tcp_recv__(corenet_node_t *node, int toread)
 {
         int ret;
@@ -441,11 +866,7 @@ static int __corenet_tcp_recv__(corenet_node_t *node, int toread)
 
         DBUG("read data %u\n", toread);
 
-#if ENABLE_TCP_THREAD
         ret = __corenet_tcp_remote(node->sockid.sd, &buf, __OP_RECV__);
-#else
-        ret = __corenet_tcp_local(node->sockid.sd, &buf, __OP_RECV__);
-#endif
         if (ret < 0) {
                 ret = -ret;
                 GOTO(err_free, ret);
@@ -478,6 +899,7 @@ static int __corenet_tcp_recv(corenet_node_t *node, int *count)
         }
 
         DBUG("recv %u\n", toread);
+        TRACE(TRACE_NET_RECV, node->sockid.sd, toread, NULL);
 
         if (toread == 0) {
                 ret = ECONNRESET;
@@ -513,6 +935,369 @@ err_ret:
         return ret;
 }
 
+#else
+
+static void __corenet_tcp_recv_win_free(corenet_tcp_t *__corenet__,
+                                        corenet_node_t *node)
+{
+        ltgbuf_free(&node->recv_win);
+        node->recv_off = 0;
+
+        if (node->recv_huge) {
+                node->recv_huge = 0;
+                __corenet__->recv_wins--;
+        }
+}
+
+/*
+ * at most CORENET_TCP_RECV_WINS windows of a core come from hugepages,
+ * connections beyond that read into sys memory and copy out.
+ */
+static int __corenet_tcp_recv_win_new(corenet_tcp_t *__corenet__,
+                                      corenet_node_t *node)
+{
+        int ret;
+
+        __corenet_tcp_recv_win_free(__corenet__, node);
+
+        if (likely(__corenet__->recv_wins < CORENET_TCP_RECV_WINS)) {
+                ret = ltgbuf_init(&node->recv_win, CORENET_TCP_RECV_WIN);
+                if (unlikely(ret))
+                        GOTO(err_ret, ret);
+
+                node->recv_huge = 1;
+                __corenet__->recv_wins++;
+        } else {
+                ret = ltgbuf_init1(&node->recv_win, CORENET_TCP_RECV_WIN);
+                if (unlikely(ret))
+                        GOTO(err_ret, ret);
+        }
+
+        return 0;
+err_ret:
+        return ret;
+}
+
+/*
+ * small reads are copied to sys memory and the window space is reused, so
+ * a small message kept by its consumer does not pin the hugepage.
+ */
+static int __corenet_tcp_recv_copy(corenet_node_t *node, uint32_t size)
+{
+        int ret;
+        ltgbuf_t buf;
+
+        ret = ltgbuf_init1(&buf, size);
+        if (unlikely(ret))
+                GOTO(err_ret, ret);
+
+        ret = ltgbuf_get1(&node->recv_win, ltgbuf_head(&buf), node->recv_off, size);
+        if (unlikely(ret))
+                GOTO(err_free, ret);
+
+        ltgbuf_merge(&node->recv_buf, &buf);
+
+        return 0;
+err_free:
+        ltgbuf_free(&buf);
+err_ret:
+        return ret;
+}
+
+/*
+ * read into the window from recv_off, a new window is taken once the old
+ * one is full, the old one lives on in the slices still in use.
+ * @return bytes read, 0 if the socket is drained
+ */
+static int __corenet_tcp_recv__(corenet_node_t *node, uint32_t *_room)
+{
+        int ret, iov_count, size;
+        uint32_t room;
+        struct msghdr msg;
+        corenet_tcp_t *__corenet__ = __corenet_get();
+
+        if (unlikely(node->recv_off == node->recv_win.len)) {
+                ret = __corenet_tcp_recv_win_new(__corenet__, node);
+                if (unlikely(ret))
+                        GOTO(err_ret, ret);
+        }
+
+        room = node->recv_win.len - node->recv_off;
+        iov_count = CORE_IOV_MAX;
+        ltgbuf_trans2(__corenet__->iov, &iov_count, node->recv_off, room,
+                      &node->recv_win);
+
+        memset(&msg, 0x0, sizeof(msg));
+        msg.msg_iov = __corenet__->iov;
+        msg.msg_iovlen = iov_count;
+
+        size = _recvmsg(node->sockid.sd, &msg, MSG_DONTWAIT);
+        if (size < 0) {
+                ret = -size;
+                if (ret == EAGAIN || ret == EWOULDBLOCK)
+                        return 0;
+
+                DWARN("sd %u %u %s\n", node->sockid.sd, ret, strerror(ret));
+                GOTO(err_ret, ret);
+        } else if (size == 0) {
+                ret = ECONNRESET;
+                GOTO(err_ret, ret);
+        }
+
+        if (size <= CORENET_TCP_RECV_COPY || !node->recv_huge) {
+                ret = __corenet_tcp_recv_copy(node, size);
+                if (unlikely(ret))
+                        GOTO(err_ret, ret);
+
+                *_room = room;
+                return size;
+        }
+
+        ret = ltgbuf_slice(&node->recv_buf, &node->recv_win, node->recv_off, size);
+        if (unlikely(ret))
+                GOTO(err_ret, ret);
+
+        node->recv_off += size;
+        *_room = room;
+
+        return size;
+err_ret:
+        return -ret;
+}
+
+/*
+ * no FIONREAD, read until the socket is drained, a short read means it
+ * is, or CORENET_TCP_RECV_MAX per event, epoll is level triggered and
+ * brings us back for the rest.
+ */
+static int __corenet_tcp_recv(corenet_node_t *node, int *count)
+{
+        int ret, size;
+        uint32_t room = 0, total = 0;
+
+        ANALYSIS_BEGIN(0);
+
+        while (total < CORENET_TCP_RECV_MAX) {
+                size = __corenet_tcp_recv__(node, &room);
+                if (unlikely(size < 0)) {
+                        ret = -size;
+                        GOTO(err_ret, ret);
+                }
+
+                total += size;
+                if (size == 0 || (uint32_t)size < room)
+                        break;
+        }
+
+        DBUG("recv %u\n", total);
+        TRACE(TRACE_NET_RECV, node->sockid.sd, total, NULL);
+
+        if (unlikely(total == 0)) {
+                *count = 0;
+                return 0;
+        }
+
+        // __iscsi_newtask_core
+        // corerpc_recv
+        ret = node->exec(node->ctx, &node->recv_buf, count);
+        if (unlikely(ret))
+                GOTO(err_ret, ret);
+
+        ANALYSIS_QUEUE(0, IO_WARN, NULL);
+
+        return 0;
+err_ret:
+        return ret;
+}
+#endif
+
+#if !ENABLE_TCP_THREAD
+
+typedef struct {
+        struct list_head hook;
+        uint32_t id;            // zerocopy send call, the error queue reports it
+        int done;
+        ltgbuf_t buf;
+} corenet_zc_t;
+
+static void __corenet_tcp_zerocopy_init(corenet_tcp_t *__corenet__, corenet_node_t *node)
+{
+        int ret, on = 1;
+
+        if (likely(ltgconf_global.tcp_zerocopy == 0 || node->recv
+                   || __corenet__->uring)) {
+                return;
+        }
+
+        ret = setsockopt(node->sockid.sd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on));
+        if (unlikely(ret)) {
+                ret = errno;
+                DWARN("sd %u SO_ZEROCOPY %s\n", node->sockid.sd, strerror(ret));
+                return;
+        }
+
+        node->zerocopy = 1;
+        node->zc_next = 0;
+}
+
+static void __corenet_tcp_zerocopy_free(corenet_node_t *node)
+{
+        struct linger linger;
+        corenet_zc_t *zc;
+
+        if (!list_empty(&node->zc_list)) {
+                // reset instead of draining, nothing may go out of memory we give back
+                linger.l_onoff = 1;
+                linger.l_linger = 0;
+                setsockopt(node->sockid.sd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+        }
+
+        while (!list_empty(&node->zc_list)) {
+                zc = list_entry(node->zc_list.next, corenet_zc_t, hook);
+                list_del(&zc->hook);
+                ltgbuf_free(&zc->buf);
+                slab_stream_free(zc);
+        }
+
+        node->zerocopy = 0;
+        node->zc_next = 0;
+}
+
+/*
+ * sends from buf, those of buf->len >= tcp_zerocopy with MSG_ZEROCOPY.
+ *
+ * the bytes sent go to zc_list instead of being freed, a partial seg left
+ * in buf only lends its head to them, so zc_list is freed in order and
+ * smaller sends join the last entry while any is pending.
+ */
+static int __corenet_tcp_zerocopy(corenet_node_t *node, ltgbuf_t *buf)
+{
+        int ret, zerocopy;
+        corenet_zc_t *zc;
+
+        zerocopy = buf->len >= (uint64_t)ltgconf_global.tcp_zerocopy;
+
+        ret = __corenet_tcp_local(node->sockid.sd, buf, __OP_SEND__,
+                                  zerocopy ? MSG_ZEROCOPY : 0);
+        if (unlikely(ret == -ENOBUFS && zerocopy)) {
+                // optmem_max used up by pending notifications
+                zerocopy = 0;
+                ret = __corenet_tcp_local(node->sockid.sd, buf, __OP_SEND__, 0);
+        }
+
+        if (ret < 0) {
+                ret = -ret;
+                GOTO(err_ret, ret);
+        }
+
+        if (zerocopy) {
+                zc = slab_stream_alloc(sizeof(*zc));
+                LTG_ASSERT(zc);
+                zc->id = node->zc_next++;
+                zc->done = 0;
+                ltgbuf_init(&zc->buf, 0);
+                list_add_tail(&zc->hook, &node->zc_list);
+        } else if (!list_empty(&node->zc_list)) {
+                zc = list_entry(node->zc_list.prev, corenet_zc_t, hook);
+        } else {
+                ltgbuf_pop(buf, NULL, ret);
+                return 0;
+        }
+
+        ltgbuf_pop(buf, &zc->buf, ret);
+
+        return 0;
+err_ret:
+        return ret;
+}
+
+/*
+ * EPOLLERR on a zerocopy socket, reap the notifications
+ *
+ * @return the pending socket error, 0 if the error queue was all
+ */
+static int __corenet_tcp_zerocopy_reap(corenet_node_t *node)
+{
+        int ret, err, copied = 0;
+        uint32_t lo, hi;
+        socklen_t len;
+        struct msghdr msg;
+        struct cmsghdr *cmsg;
+        struct sock_extended_err *serr;
+        struct list_head *pos;
+        corenet_zc_t *zc;
+        char control[CMSG_SPACE(sizeof(*serr)) * 4];
+
+        while (1) {
+                memset(&msg, 0x0, sizeof(msg));
+                msg.msg_control = control;
+                msg.msg_controllen = sizeof(control);
+
+                ret = recvmsg(node->sockid.sd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+                if (ret < 0) {
+                        ret = errno;
+                        if (ret == EAGAIN || ret == EWOULDBLOCK)
+                                break;
+
+                        GOTO(err_ret, ret);
+                }
+
+                for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                        if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+                              || (cmsg->cmsg_level == SOL_IPV6
+                                  && cmsg->cmsg_type == IPV6_RECVERR))) {
+                                continue;
+                        }
+
+                        serr = (void *)CMSG_DATA(cmsg);
+                        if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                                continue;
+                        }
+
+                        lo = serr->ee_info;
+                        hi = serr->ee_data;
+                        if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                                copied = 1;
+
+                        list_for_each(pos, &node->zc_list) {
+                                zc = (void *)pos;
+                                if (zc->id - lo <= hi - lo)
+                                        zc->done = 1;
+                        }
+                }
+        }
+
+        while (!list_empty(&node->zc_list)) {
+                zc = list_entry(node->zc_list.next, corenet_zc_t, hook);
+                if (!zc->done)
+                        break;
+
+                list_del(&zc->hook);
+                ltgbuf_free(&zc->buf);
+                slab_stream_free(zc);
+        }
+
+        if (unlikely(copied && list_empty(&node->zc_list))) {
+                // the kernel copied anyway (loopback and the like), stop pinning
+                DINFO("sd %u zerocopy copied, off\n", node->sockid.sd);
+                node->zerocopy = 0;
+        }
+
+        err = 0;
+        len = sizeof(err);
+        ret = getsockopt(node->sockid.sd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (unlikely(ret)) {
+                ret = errno;
+                GOTO(err_ret, ret);
+        }
+
+        return err;
+err_ret:
+        return ret;
+}
+
+#endif
+
 static int __corenet_tcp_send(corenet_node_t *node)
 {
         int ret;
@@ -523,10 +1308,19 @@ static int __corenet_tcp_send(corenet_node_t *node)
         buf = &node->send_buf;
         if (likely(buf->len)) {
                 DBUG("send %u\n", buf->len);
+                TRACE(TRACE_NET_SEND, node->sockid.sd, buf->len, NULL);
 #if ENABLE_TCP_THREAD
                 ret = __corenet_tcp_remote(node->sockid.sd, buf, __OP_SEND__);
 #else
-                ret = __corenet_tcp_local(node->sockid.sd, buf, __OP_SEND__);
+                if (node->zerocopy) {
+                        ret = __corenet_tcp_zerocopy(node, buf);
+                        if (unlikely(ret))
+                                GOTO(err_ret, ret);
+
+                        goto out;
+                }
+
+                ret = __corenet_tcp_local(node->sockid.sd, buf, __OP_SEND__, 0);
 #endif
                 if (ret < 0) {
                         ret = -ret;
@@ -545,6 +1339,9 @@ static int __corenet_tcp_send(corenet_node_t *node)
 #endif
         }
 
+#if !ENABLE_TCP_THREAD
+out:
+#endif
         ANALYSIS_QUEUE(0, IO_WARN, NULL);
 
         return 0;
@@ -1102,18 +1899,33 @@ static int __corenet_tcp_exec(void *ctx, corenet_node_t *node, event_t *ev)
 
         DBUG("ev %x\n", ev->events);
 
+        // zerocopy notifications come as EPOLLERR too
+        if (unlikely((ev->events & EPOLLERR) && node->zerocopy)) {
+                ret = __corenet_tcp_zerocopy_reap(node);
+                if (unlikely(ret))
+                        GOTO(err_ret, ret);
+
+                ev->events &= ~EPOLLERR;
+        }
+
         if (unlikely((ev->events & EPOLLRDHUP) || (ev->events & EPOLLERR))
             || (ev->events & EPOLLHUP))  {
                 ret = ECONNRESET;
                 GOTO(err_ret, ret);
         }
 
+        // the raw send never yields and runs without a task, so does recv
+        // on corerpc sockets. other execs may yield, they keep a task
         if (ev->events & EPOLLOUT) {
-                sche_task_new("corenet_tcp_send", __corenet_tcp_exec_send, node, -1);
+                sche_task_inline("corenet_tcp_send", __corenet_tcp_exec_send, node);
         }
 
         if (ev->events & EPOLLIN) {
-                sche_task_new("corenet_tcp_recv", __corenet_tcp_exec_recv, node, -1);
+                if (node->nonblock) {
+                        sche_task_inline("corenet_tcp_recv", __corenet_tcp_exec_recv, node);
+                } else {
+                        sche_task_new("corenet_tcp_recv", __corenet_tcp_exec_recv, node, -1);
+                }
         }
 
         sche_run(core_tls_get(ctx, VARIABLE_SCHEDULE));
@@ -1127,22 +1939,44 @@ err_ret:
 #endif
 #endif
 
+// tmo in ms
 int corenet_tcp_poll(void *ctx, int tmo)
 {
         int nfds, i;
         event_t events[512], *ev;
         corenet_node_t *node;
+        core_t *core = core_self();
         corenet_tcp_t *__corenet__ = __corenet_get_byctx(ctx);
 
         DBUG("polling %d begin\n", tmo);
-        LTG_ASSERT(tmo >= 0 && tmo < ltgconf_global.rpc_timeout * 2);
-        nfds = _epoll_wait(__corenet__->corenet.epoll_fd, events, 512, (tmo ? 1 : 0) * 1000);
+        LTG_ASSERT(tmo >= 0 && tmo <= 1000);
+
+        // held sends must not wait for the next event
+        if (unlikely(!list_empty(&__corenet__->corenet.forward_list)))
+                tmo = 0;
+
+#if !ENABLE_TCP_THREAD
+        if (__corenet__->uring) {
+                (void) ev;
+                (void) node;
+                (void) i;
+                nfds = corenet_uring_poll(__corenet__->uring, tmo,
+                                          __corenet_uring_cqe, __corenet__);
+                DBUG("polling %d return\n", nfds);
+                if (nfds > 0)
+                        core->poll_event += nfds;
+                sche_run(core_tls_get(ctx, VARIABLE_SCHEDULE));
+                return 0;
+        }
+#endif
+        nfds = _epoll_wait(__corenet__->corenet.epoll_fd, events, 512, tmo);
         if (unlikely(nfds < 0)) {
                 UNIMPLEMENTED(__DUMP__);
         }
 
         DBUG("polling %d return\n", nfds);
 
+        core->poll_event += nfds;
         for (i = 0; i < nfds; i++) {
                 //ANALYSIS_BEGIN(0);
                 ev = &events[i];
@@ -1155,48 +1989,57 @@ int corenet_tcp_poll(void *ctx, int tmo)
         return 0;
 }
 
-typedef struct {
-        struct list_head hook;
-        sockid_t sockid;
-        ltgbuf_t buf;
-} corenet_fwd_t;
-
-static void __corenet_tcp_queue(corenet_tcp_t *__corenet__, const sockid_t *sockid,
+static void __corenet_tcp_queue(corenet_tcp_t *__corenet__, corenet_node_t *node,
                                 ltgbuf_t *buf)
 {
-        int found = 0;
-        corenet_fwd_t *corenet_fwd;
-        struct list_head *pos;
-
-        DBUG("corenet_fwd\n");
+        ltgbuf_merge(&node->queue_buf, buf);
+        __corenet__->c_msg++;
 
-        list_for_each(pos, &__corenet__->corenet.forward_list) {
-                corenet_fwd = (void *)pos;
+        if (list_empty(&node->send_list)) {
+                DBUG("new forward to %s @ %u\n",
+                      _inet_ntoa(node->sockid.addr), node->sockid.sd);
 
-                if (sockid_cmp(sockid, &corenet_fwd->sockid) == 0) {
-                        DBUG("append forward to %s @ %u\n",
-                              _inet_ntoa(sockid->addr), sockid->sd);
+                if (node->flush_bytes)
+                        node->queue_time = get_rdtsc();
 
-                        ltgbuf_merge(&corenet_fwd->buf, buf);
+                list_add_tail(&node->send_list, &__corenet__->corenet.forward_list);
+        }
+}
 
-                        found = 1;
-                        break;
-                }
+/*
+ * coalesce small frames, a connection with less than flush_bytes queued
+ * waits for more until its oldest byte is flush_delay old
+ */
+static int __corenet_tcp_hold(corenet_node_t *node, uint64_t *now)
+{
+        if (likely(node->flush_bytes == 0
+                   || node->queue_buf.len >= node->flush_bytes)) {
+                return 0;
         }
 
-        if (found == 0) {
-                DBUG("new forward to %s @ %u\n",
-                      _inet_ntoa(sockid->addr), sockid->sd);
+        if (*now == 0)
+                *now = get_rdtsc();
 
-                corenet_fwd = slab_stream_alloc(sizeof(*corenet_fwd));
-                LTG_ASSERT(corenet_fwd);
-                corenet_fwd->sockid = *sockid;
-                ltgbuf_init(&corenet_fwd->buf, 0);
+        return *now - node->queue_time < node->flush_delay;
+}
 
-                ltgbuf_merge(&corenet_fwd->buf, buf);
+/*
+ * take the staged data of the first dirty node, the node leaves the list
+ * so a send during the commit queues it again
+ */
+static corenet_node_t *__corenet_tcp_dequeue(struct list_head *list,
+                                             sockid_t *sockid, ltgbuf_t *buf)
+{
+        corenet_node_t *node;
 
-                list_add_tail(&corenet_fwd->hook, &__corenet__->corenet.forward_list);
-        }
+        node = list_entry(list->next, corenet_node_t, send_list);
+        list_del_init(&node->send_list);
+
+        *sockid = node->sockid;
+        ltgbuf_init(buf, 0);
+        ltgbuf_merge(buf, &node->queue_buf);
+
+        return node;
 }
 
 int corenet_tcp_send(void *ctx, const sockid_t *sockid, ltgbuf_t *buf)
@@ -1217,7 +2060,7 @@ int corenet_tcp_send(void *ctx, const sockid_t *sockid, ltgbuf_t *buf)
                 GOTO(err_ret, ret);
         }
 
-        __corenet_tcp_queue(__corenet__, sockid, buf);
+        __corenet_tcp_queue(__corenet__, node, buf);
 
         ANALYSIS_QUEUE(0, 10 * 1000, NULL);
 
@@ -1247,6 +2090,7 @@ static int __corenet_tcp_commit(const sockid_t *sockid, ltgbuf_t *buf)
                 GOTO(err_lock, ret);
         }
 
+        TRACE(TRACE_NET_COMMIT, sockid->sd, buf->len, NULL);
         ltgbuf_merge(&node->send_buf, buf);
 
 #if 1
@@ -1276,24 +2120,21 @@ err_ret:
 
 static void __corenet_tcp_commit_task(void *ctx)
 {
-        struct list_head *pos, *n;
-        corenet_fwd_t *corenet_fwd;
+        sockid_t sockid;
+        ltgbuf_t buf;
         corenet_tcp_t *__corenet__ = __corenet_get_byctx(ctx);
         struct list_head list;
 
         INIT_LIST_HEAD(&list);
         list_splice_init(&__corenet__->corenet.forward_list, &list);
 
-        list_for_each_safe(pos, n, &list) {
-                corenet_fwd = (void *)pos;
-                list_del(pos);
-
-                DBUG("forward to %s @ %u\n",
-                     _inet_ntoa(corenet_fwd->sockid.addr), corenet_fwd->sockid.sd);
+        // one at a time, a close while we wait on the lock unlinks its node
+        while (!list_empty(&list)) {
+                __corenet_tcp_dequeue(&list, &sockid, &buf);
 
-                __corenet_tcp_commit(&corenet_fwd->sockid, &corenet_fwd->buf);
+                DBUG("forward to %s @ %u\n", _inet_ntoa(sockid.addr), sockid.sd);
 
-                slab_stream_free(corenet_fwd);
+                __corenet_tcp_commit(&sockid, &buf);
         }
 }
 
@@ -1344,10 +2185,19 @@ static int __corenet_tcp_commit(void *ctx, const sockid_t *sockid, ltgbuf_t *buf
                 GOTO(err_ret, ret);
         }
 
+        TRACE(TRACE_NET_COMMIT, sockid->sd, buf->len, NULL);
         ltgbuf_merge(&node->send_buf, buf);
 
+        if (__corenet__->uring) {
+                // in flight, the completion sends the rest
+                if (node->uring & CORENET_URING_SEND)
+                        return 0;
+
+                return __corenet_uring_send(__corenet__, node);
+        }
+
 #if 1
-        sche_task_new("corenet_tcp_send", __corenet_tcp_exec_send_nowait, node, -1);
+        sche_task_inline("corenet_tcp_send", __corenet_tcp_exec_send_nowait, node);
         sche_run(core_tls_get(ctx, VARIABLE_SCHEDULE));
 #else
 #if 0
@@ -1369,21 +2219,48 @@ err_ret:
 
 void corenet_tcp_commit(void *ctx)
 {
-        struct list_head *pos, *n;
-        corenet_fwd_t *corenet_fwd;
+        int ret;
+        sockid_t sockid;
+        ltgbuf_t buf;
+        uint64_t now = 0;
+        corenet_node_t *node;
+        struct list_head hold;
         corenet_tcp_t *__corenet__ = __corenet_get_byctx(ctx);
+        struct list_head *list = &__corenet__->corenet.forward_list;
 
-        list_for_each_safe(pos, n, &__corenet__->corenet.forward_list) {
-                corenet_fwd = (void *)pos;
-                list_del(pos);
+        INIT_LIST_HEAD(&hold);
+
+        while (!list_empty(list)) {
+                node = list_entry(list->next, corenet_node_t, send_list);
+                if (__corenet_tcp_hold(node, &now)) {
+                        list_move_tail(&node->send_list, &hold);
+                        __corenet__->c_hold++;
+                        continue;
+                }
+
+                node = __corenet_tcp_dequeue(list, &sockid, &buf);
 
                 DBUG("forward to %s @ %u, buf %u\n",
-                      _inet_ntoa(corenet_fwd->sockid.addr), corenet_fwd->sockid.sd,
-                      corenet_fwd->buf.len);
+                      _inet_ntoa(sockid.addr), sockid.sd, buf.len);
 
-                __corenet_tcp_commit(ctx, &corenet_fwd->sockid, &corenet_fwd->buf);
+                ret = __corenet_tcp_commit(ctx, &sockid, &buf);
+                if (unlikely(ret == ENOSPC)) {
+                        // sq full, left in send_buf for the next round
+                        DWARN("sd %u sq full\n", sockid.sd);
+                        __corenet_uring_send_retry(__corenet__, node);
+                        break;
+                }
+        }
+
+        list_splice_init(&hold, list);
 
-                slab_stream_free(corenet_fwd);
+        // one io_uring_enter for all the sendmsg of this round
+        if (__corenet__->uring) {
+                if (unlikely(!list_empty(&__corenet__->uring_arm))) {
+                        __corenet_uring_arm_pending(__corenet__);
+                }
+
+                corenet_uring_submit(__corenet__->uring);
         }
 
         sche_run(core_tls_get(ctx, VARIABLE_SCHEDULE));
@@ -1423,7 +2300,7 @@ int corenet_tcp_init(int count, corenet_tcp_t **_corenet)
 
         DINFO("count %d size %d\n", count, len);
 
-        ret = ltg_malloc((void **)&corenet, len);
+        ret = ltg_malloc_local((void **)&corenet, len);
         if (unlikely(ret))
                 GOTO(err_ret, ret);
 
@@ -1440,7 +2317,14 @@ int corenet_tcp_init(int count, corenet_tcp_t **_corenet)
 #endif
 
                 ltgbuf_init(&node->recv_buf, 0);
+                ltgbuf_init(&node->recv_win, 0);
+                node->recv_off = 0;
+                node->recv_huge = 0;
                 ltgbuf_init(&node->send_buf, 0);
+                ltgbuf_init(&node->queue_buf, 0);
+                INIT_LIST_HEAD(&node->send_list);
+                INIT_LIST_HEAD(&node->zc_list);
+                INIT_LIST_HEAD(&node->uring_arm);
                 node->sockid.sd = -1;
         }
 
@@ -1453,6 +2337,19 @@ int corenet_tcp_init(int count, corenet_tcp_t **_corenet)
         INIT_LIST_HEAD(&corenet->corenet.forward_list);
         INIT_LIST_HEAD(&corenet->corenet.check_list);
 
+#if !ENABLE_TCP_THREAD
+        INIT_LIST_HEAD(&corenet->uring_arm);
+        if (ltgconf_global.tcp_uring) {
+                ret = corenet_uring_create(&corenet->uring, CORENET_URING_ENTRIES,
+                                           CORENET_URING_BUF_COUNT,
+                                           CORENET_URING_BUF_SIZE);
+                if (unlikely(ret)) {
+                        DWARN("io_uring unavailable, %s, use epoll\n", strerror(ret));
+                        corenet->uring = NULL;
+                }
+        }
+#endif
+
         ret = ltg_spin_init(&corenet->corenet.lock);
         if (unlikely(ret))
                 GOTO(err_free, ret);
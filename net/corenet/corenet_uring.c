@@ -0,0 +1,489 @@
+#include <limits.h>
+#include <time.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <errno.h>
+
+#define DBG_SUBSYS S_LTG_NET
+
+#include "ltg_utils.h"
+#include "ltg_core.h"
+#include "ltg_net.h"
+
+/**
+ * per core io_uring for corenet_tcp, raw syscalls, no liburing.
+ *
+ * sqes are queued by corenet_uring_sqe and handed to the kernel in one
+ * io_uring_enter by corenet_uring_submit (corenet routine, end of the
+ * worker round) or by corenet_uring_poll before it waits.
+ *
+ * multishot recv picks buffers from a provided buffer ring, the buffers
+ * are hugepage ltgbuf, corenet_uring_buf_take hands the data over as a
+ * slice and puts a fresh buffer in its place.
+ */
+
+struct corenet_uring {
+        int fd;
+        uint32_t features;
+
+        void *sq_ptr;
+        size_t sq_size;
+        uint32_t *sq_head;
+        uint32_t *sq_tail;
+        uint32_t sq_mask;
+        uint32_t sq_entries;
+        uint32_t *sq_array;
+        struct io_uring_sqe *sqes;
+        size_t sqes_size;
+        uint32_t sqe_tail;              // queued, published by submit
+        uint32_t sqe_submit;            // taken by the kernel
+
+        uint32_t *cq_head;
+        uint32_t *cq_tail;
+        uint32_t cq_mask;
+        struct io_uring_cqe *cqes;
+
+        struct io_uring_buf_ring *br;
+        uint32_t br_count;
+        uint16_t br_tail;
+        uint32_t buf_size;
+        ltgbuf_t *bufs;
+
+        uint64_t c_enter;
+        uint64_t c_sqe;
+        uint64_t c_cqe;
+};
+
+static int __io_uring_setup(uint32_t entries, struct io_uring_params *p)
+{
+        return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int __io_uring_enter(int fd, uint32_t to_submit, uint32_t min_complete,
+                            uint32_t flags, void *arg, size_t argsz)
+{
+        return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                       flags, arg, argsz);
+}
+
+static int __io_uring_register(int fd, uint32_t opcode, void *arg, uint32_t nr_args)
+{
+        return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/*
+ * multishot recv and provided buffer rings came with 6.0, IORING_OP_SEND_ZC
+ * is the first op of that release so it stands for them in the probe
+ */
+static int __corenet_uring_probe(corenet_uring_t *uring)
+{
+        int ret, i;
+        struct io_uring_probe *probe;
+        uint8_t ops[] = {IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_POLL_ADD,
+                         IORING_OP_ASYNC_CANCEL, IORING_OP_SEND_ZC};
+        uint32_t need = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP
+                | IORING_FEAT_FAST_POLL | IORING_FEAT_EXT_ARG;
+
+        if ((uring->features & need) != need) {
+                DWARN("io_uring features 0x%x, need 0x%x\n", uring->features, need);
+                ret = ENOTSUP;
+                GOTO(err_ret, ret);
+        }
+
+        ret = ltg_malloc((void **)&probe, sizeof(*probe)
+                         + sizeof(struct io_uring_probe_op) * 256);
+        if (unlikely(ret))
+                GOTO(err_ret, ret);
+
+        memset(probe, 0x0, sizeof(*probe) + sizeof(struct io_uring_probe_op) * 256);
+        ret = __io_uring_register(uring->fd, IORING_REGISTER_PROBE, probe, 256);
+        if (ret < 0) {
+                ret = errno;
+                GOTO(err_free, ret);
+        }
+
+        for (i = 0; i < (int)(sizeof(ops) / sizeof(ops[0])); i++) {
+                if (ops[i] > probe->last_op
+                    || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+                        DWARN("io_uring op %u not supported\n", ops[i]);
+                        ret = ENOTSUP;
+                        GOTO(err_free, ret);
+                }
+        }
+
+        ltg_free((void **)&probe);
+
+        return 0;
+err_free:
+        ltg_free((void **)&probe);
+err_ret:
+        return ret;
+}
+
+static int __corenet_uring_mmap(corenet_uring_t *uring, struct io_uring_params *p)
+{
+        int ret;
+        size_t cq_size;
+
+        uring->sq_size = p->sq_off.array + p->sq_entries * sizeof(uint32_t);
+        cq_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+        if (cq_size > uring->sq_size)
+                uring->sq_size = cq_size;
+
+        // IORING_FEAT_SINGLE_MMAP, sq and cq share one mapping
+        uring->sq_ptr = mmap(NULL, uring->sq_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, uring->fd,
+                             IORING_OFF_SQ_RING);
+        if (uring->sq_ptr == MAP_FAILED) {
+                ret = errno;
+                GOTO(err_ret, ret);
+        }
+
+        uring->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+        uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES);
+        if (uring->sqes == MAP_FAILED) {
+                ret = errno;
+                GOTO(err_unmap, ret);
+        }
+
+        uring->sq_head = uring->sq_ptr + p->sq_off.head;
+        uring->sq_tail = uring->sq_ptr + p->sq_off.tail;
+        uring->sq_mask = *(uint32_t *)(uring->sq_ptr + p->sq_off.ring_mask);
+        uring->sq_entries = p->sq_entries;
+        uring->sq_array = uring->sq_ptr + p->sq_off.array;
+        uring->sqe_tail = *uring->sq_tail;
+        uring->sqe_submit = uring->sqe_tail;
+
+        uring->cq_head = uring->sq_ptr + p->cq_off.head;
+        uring->cq_tail = uring->sq_ptr + p->cq_off.tail;
+        uring->cq_mask = *(uint32_t *)(uring->sq_ptr + p->cq_off.ring_mask);
+        uring->cqes = uring->sq_ptr + p->cq_off.cqes;
+
+        return 0;
+err_unmap:
+        munmap(uring->sq_ptr, uring->sq_size);
+err_ret:
+        return ret;
+}
+
+static void __corenet_uring_buf_add(corenet_uring_t *uring, int bid)
+{
+        struct io_uring_buf *buf;
+
+        buf = &uring->br->bufs[uring->br_tail & (uring->br_count - 1)];
+        buf->addr = (uint64_t)ltgbuf_head(&uring->bufs[bid]);
+        buf->len = uring->buf_size;
+        buf->bid = bid;
+
+        uring->br_tail++;
+        __atomic_store_n(&uring->br->tail, uring->br_tail, __ATOMIC_RELEASE);
+}
+
+static int __corenet_uring_buf_new(corenet_uring_t *uring, int bid)
+{
+        int ret;
+        ltgbuf_t *buf = &uring->bufs[bid];
+
+        ret = ltgbuf_init(buf, uring->buf_size);
+        if (unlikely(ret))
+                GOTO(err_ret, ret);
+
+        // one contiguous seg, it is a single recv target
+        LTG_ASSERT(buf->list.next == buf->list.prev);
+
+        __corenet_uring_buf_add(uring, bid);
+
+        return 0;
+err_ret:
+        return ret;
+}
+
+static int __corenet_uring_buf_init(corenet_uring_t *uring, uint32_t count,
+                                    uint32_t size)
+{
+        int ret;
+        uint32_t i;
+        size_t len;
+        struct io_uring_buf_reg reg;
+
+        LTG_ASSERT((count & (count - 1)) == 0 && count <= 32768);
+
+        len = _align_up(sizeof(struct io_uring_buf) * count, PAGE_SIZE);
+        uring->br = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (uring->br == MAP_FAILED) {
+                ret = errno;
+                GOTO(err_ret, ret);
+        }
+
+        memset(&reg, 0x0, sizeof(reg));
+        reg.ring_addr = (uint64_t)uring->br;
+        reg.ring_entries = count;
+        reg.bgid = CORENET_URING_BGID;
+        ret = __io_uring_register(uring->fd, IORING_REGISTER_PBUF_RING, &reg, 1);
+        if (ret < 0) {
+                ret = errno;
+                DWARN("register pbuf ring %u %s\n", ret, strerror(ret));
+                GOTO(err_unmap, ret);
+        }
+
+        uring->br_count = count;
+        uring->br_tail = 0;
+        uring->buf_size = size;
+
+        ret = ltg_malloc((void **)&uring->bufs, sizeof(ltgbuf_t) * count);
+        if (unlikely(ret))
+                GOTO(err_unmap, ret);
+
+        for (i = 0; i < count; i++) {
+                ret = __corenet_uring_buf_new(uring, i);
+                if (unlikely(ret))
+                        UNIMPLEMENTED(__DUMP__);
+        }
+
+        return 0;
+err_unmap:
+        munmap(uring->br, len);
+        uring->br = NULL;
+err_ret:
+        return ret;
+}
+
+/**
+ * @return ENOTSUP and friends if the kernel is too old, the caller stays
+ * on epoll then
+ */
+int corenet_uring_create(corenet_uring_t **_uring, uint32_t entries,
+                         uint32_t buf_count, uint32_t buf_size)
+{
+        int ret;
+        corenet_uring_t *uring;
+        struct io_uring_params p;
+
+        ret = ltg_malloc_local((void **)&uring, sizeof(*uring));
+        if (unlikely(ret))
+                GOTO(err_ret, ret);
+
+        memset(uring, 0x0, sizeof(*uring));
+
+        memset(&p, 0x0, sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER;
+        p.cq_entries = entries * 4;
+        uring->fd = __io_uring_setup(entries, &p);
+        if (uring->fd < 0 && errno == EINVAL) {
+                memset(&p, 0x0, sizeof(p));
+                p.flags = IORING_SETUP_CQSIZE;
+                p.cq_entries = entries * 4;
+                uring->fd = __io_uring_setup(entries, &p);
+        }
+
+        if (uring->fd < 0) {
+                ret = errno;
+                DWARN("io_uring_setup %u %s\n", ret, strerror(ret));
+                GOTO(err_free, ret);
+        }
+
+        uring->features = p.features;
+
+        ret = __corenet_uring_probe(uring);
+        if (unlikely(ret))
+                GOTO(err_close, ret);
+
+        ret = __corenet_uring_mmap(uring, &p);
+        if (unlikely(ret))
+                GOTO(err_close, ret);
+
+        ret = __corenet_uring_buf_init(uring, buf_count, buf_size);
+        if (unlikely(ret))
+                GOTO(err_unmap, ret);
+
+        DINFO("io_uring fd %d sq %u cq %u features 0x%x buf %u*%u\n",
+              uring->fd, p.sq_entries, p.cq_entries, p.features,
+              buf_count, buf_size);
+
+        *_uring = uring;
+
+        return 0;
+err_unmap:
+        munmap(uring->sqes, uring->sqes_size);
+        munmap(uring->sq_ptr, uring->sq_size);
+err_close:
+        close(uring->fd);
+err_free:
+        ltg_free((void **)&uring);
+err_ret:
+        return ret;
+}
+
+/**
+ * submit the sqes queued so far, one syscall for the whole round
+ */
+int IO_FUNC corenet_uring_submit(corenet_uring_t *uring)
+{
+        int ret;
+        uint32_t count;
+
+        count = uring->sqe_tail - uring->sqe_submit;
+        if (likely(count == 0))
+                return 0;
+
+        __atomic_store_n(uring->sq_tail, uring->sqe_tail, __ATOMIC_RELEASE);
+
+        ret = __io_uring_enter(uring->fd, count, 0, 0, NULL, 0);
+        uring->c_enter++;
+        if (unlikely(ret < 0)) {
+                ret = errno;
+                // EAGAIN/EBUSY, the rest goes with the next round
+                if (ret != EAGAIN && ret != EBUSY && ret != EINTR) {
+                        DERROR("io_uring_enter %u %s\n", ret, strerror(ret));
+                        UNIMPLEMENTED(__DUMP__);
+                }
+
+                return 0;
+        }
+
+        uring->sqe_submit += ret;
+
+        return ret;
+}
+
+/**
+ * @return a zeroed sqe, queued until the next submit
+ */
+struct io_uring_sqe IO_FUNC *corenet_uring_sqe(corenet_uring_t *uring)
+{
+        uint32_t idx;
+        struct io_uring_sqe *sqe;
+
+        if (unlikely(uring->sqe_tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE)
+                     >= uring->sq_entries)) {
+                corenet_uring_submit(uring);
+                if (uring->sqe_tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE)
+                    >= uring->sq_entries) {
+                        return NULL;
+                }
+        }
+
+        idx = uring->sqe_tail & uring->sq_mask;
+        sqe = &uring->sqes[idx];
+        memset(sqe, 0x0, sizeof(*sqe));
+        uring->sq_array[idx] = idx;
+        uring->sqe_tail++;
+        uring->c_sqe++;
+
+        return sqe;
+}
+
+/**
+ * submit what is queued, wait up to tmo ms if nothing completed yet and
+ * run func on each cqe
+ *
+ * @return cqe count
+ */
+int IO_FUNC corenet_uring_poll(corenet_uring_t *uring, int tmo,
+                               corenet_uring_func func, void *ctx)
+{
+        int ret;
+        uint32_t head, tail, count, pending, flags, min;
+        struct io_uring_getevents_arg arg;
+        struct __kernel_timespec ts;
+
+        head = *uring->cq_head;
+        tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+        pending = uring->sqe_tail - uring->sqe_submit;
+
+        if (head == tail && (tmo || pending)) {
+                flags = 0;
+                min = 0;
+                memset(&arg, 0x0, sizeof(arg));
+                if (tmo) {
+                        ts.tv_sec = tmo / 1000;
+                        ts.tv_nsec = (tmo % 1000) * 1000 * 1000;
+                        arg.ts = (uint64_t)&ts;
+                        flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+                        min = 1;
+                }
+
+                if (pending) {
+                        __atomic_store_n(uring->sq_tail, uring->sqe_tail,
+                                         __ATOMIC_RELEASE);
+                }
+
+                ret = __io_uring_enter(uring->fd, pending, min, flags,
+                                       tmo ? &arg : NULL, tmo ? sizeof(arg) : 0);
+                uring->c_enter++;
+                if (ret < 0) {
+                        ret = errno;
+                        if (ret != ETIME && ret != EINTR && ret != EAGAIN
+                            && ret != EBUSY) {
+                                DERROR("io_uring_enter %u %s\n", ret, strerror(ret));
+                                UNIMPLEMENTED(__DUMP__);
+                        }
+                } else {
+                        uring->sqe_submit += ret;
+                }
+
+                tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+        } else if (pending) {
+                corenet_uring_submit(uring);
+        }
+
+        count = 0;
+        while (head != tail) {
+                func(ctx, &uring->cqes[head & uring->cq_mask]);
+                head++;
+                count++;
+
+                // func may queue more, the kernel may add more
+                if (head == tail) {
+                        __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+                        tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+                }
+        }
+
+        __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+        uring->c_cqe += count;
+
+        return count;
+}
+
+/**
+ * move len bytes of buffer bid to the tail of buf without copy and give the
+ * kernel a fresh buffer in its place
+ */
+int IO_FUNC corenet_uring_buf_take(corenet_uring_t *uring, int bid,
+                                   uint32_t len, ltgbuf_t *buf)
+{
+        int ret;
+
+        LTG_ASSERT(bid >= 0 && bid < (int)uring->br_count);
+        LTG_ASSERT(len <= uring->buf_size);
+
+        ret = ltgbuf_slice(buf, &uring->bufs[bid], 0, len);
+        if (unlikely(ret))
+                GOTO(err_ret, ret);
+
+        ltgbuf_free(&uring->bufs[bid]);
+
+        ret = __corenet_uring_buf_new(uring, bid);
+        if (unlikely(ret))
+                UNIMPLEMENTED(__DUMP__);
+
+        return 0;
+err_ret:
+        __corenet_uring_buf_add(uring, bid);
+        return ret;
+}
+
+/**
+ * buffer bid came back unused, (stale cqe of a closed connection)
+ */
+void corenet_uring_buf_put(corenet_uring_t *uring, int bid)
+{
+        LTG_ASSERT(bid >= 0 && bid < (int)uring->br_count);
+
+        __corenet_uring_buf_add(uring, bid);
+}
@@ -67,7 +67,7 @@ int net_getinfo(char *infobuf, uint32_t *infobuflen, uint32_t port,
         }
                 
         info->id = *net_getnid();
-        info->magic = LTG_MSG_MAGIC;
+        info->magic = LTG_INFO_MAGIC;
         info->uptime = gettime();
 
         ret = gethostname(hostname, MAX_NAME_LEN);
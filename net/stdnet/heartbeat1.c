@@ -109,7 +109,7 @@ STATIC void __heartbeat_task(void *_ent)
 static void __heartbeat_task_new(entry_t *ent)
 {
         ent->refcount++;
-        sche_task_new("heartbeat", __heartbeat_task, ent, -1);
+        sche_task_new("heartbeat", __heartbeat_task, ent, SCHE_GROUP0);
 }
 
 static void __heartbeat_loop(void *_ent)
@@ -125,7 +125,7 @@ static void __heartbeat_loop(void *_ent)
         }
 
         __heartbeat_task_new(ent);
-        sche_task_new("heartbeat", __heartbeat_loop, ent, -1);
+        sche_task_new("heartbeat", __heartbeat_loop, ent, SCHE_GROUP0);
 }
 
 int heartbeat_add1(const sockid_t *sockid, const char *name, void *ctx,
@@ -161,9 +161,16 @@ int heartbeat_add1(const sockid_t *sockid, const char *name, void *ctx,
               sockid->sd, sockid->seq);
 
         if (sche_self()) {
-                sche_task_new("heartbeat", __heartbeat_loop, ent, -1);
+                sche_task_new("heartbeat", __heartbeat_loop, ent, SCHE_GROUP0);
         } else {
-                ret = main_loop_request(__heartbeat_loop, ent, "heartbeat");
+                while (1) {
+                        ret = main_loop_request(__heartbeat_loop, ent, "heartbeat");
+                        if (likely(ret != EAGAIN))
+                                break;
+
+                        usleep(100);
+                }
+
                 LTG_ASSERT(ret == 0);
         }
 
@@ -215,13 +215,18 @@ int main_loop_request(void (*exec)(void *buf), void *buf, const char *name)
 
         rand = ++__main_loop_request__ % (__worker_count__);
 
-        sche = __worker__[rand].sche;
-        if (sche == NULL) {
-                ret = EAGAIN;
-                GOTO(err_ret, ret);
+        // try every worker once before giving EAGAIN back
+        ret = EAGAIN;
+        for (int i = 0; i < __worker_count__; i++) {
+                sche = __worker__[(rand + i) % __worker_count__].sche;
+                if (sche == NULL)
+                        continue;
+
+                ret = sche_request(sche, -1, exec, buf, name);
+                if (likely(ret != EAGAIN))
+                        break;
         }
 
-        ret = sche_request(sche, -1, exec, buf, name);
         if (unlikely(ret))
                 GOTO(err_ret, ret);
 
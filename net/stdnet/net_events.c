@@ -33,7 +33,10 @@ int net_events_handle_read(void *_sock, void *ctx)
         buf = &rbuf->buf;
         while (buf->len >= sock->proto.head_len) {
                 ltgbuf_get(buf, tmp, sock->proto.head_len);
-                sock->proto.pack_len(tmp, sock->proto.head_len, &msg_len, &io_len);
+                ret = sock->proto.pack_len(tmp, sock->proto.head_len, &msg_len, &io_len);
+                if (unlikely(ret)) {
+                        GOTO(err_lock, ret);
+                }
 
 #if 0
                 ltg_net_head_t *head = (void *)tmp;
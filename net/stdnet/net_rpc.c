@@ -211,7 +211,7 @@ int net_rpc_hello2(const coreid_t *coreid, const sockid_t *sockid, uint64_t seq)
 
         ret = corerpc_postwait_sock("hello2", coreid, sockid,
                                     req, sizeof(*req) + count, NULL,
-                                    NULL, MSG_NET, -1, -1,
+                                    NULL, MSG_NET, -1, SCHE_GROUP0,
                                     ltgconf_global.hb_timeout);
         if (unlikely(ret))
                 GOTO(err_ret, ret);
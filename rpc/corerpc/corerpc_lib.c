@@ -44,8 +44,9 @@ void corerpc_scan(void *ctx)
 
         if (likely(__rpc_table_private__)) {
 #if 1
-                rpc_table_scan(__rpc_table_private__, _min(ltgconf_global.rpc_timeout, 2), 1);
-                sche_run(core_tls_get(ctx, VARIABLE_SCHEDULE));
+                if (rpc_table_scan(__rpc_table_private__,
+                                   _min(ltgconf_global.rpc_timeout, 2), 1))
+                        sche_run(core_tls_get(ctx, VARIABLE_SCHEDULE));
 #else
                 rpc_table_scan(__rpc_table_private__, _min(ltgconf_global.rpc_timeout, 2), 0);
 #endif
@@ -115,6 +116,7 @@ static int __corerpc_init(va_list ap)
         if (unlikely(ret))
                 GOTO(err_ret, ret);
 
+        // deadlines are expired by the private timer, see rpc_table_deadline
         ret = core_register_scan("corerpc_scan", __corerpc_scan, rpc_table);
         if (unlikely(ret))
                 GOTO(err_destroy, ret);
@@ -51,10 +51,56 @@ static void __request_stale(void *arg)
         return;
 }
 
+static void __request_expired(void *arg)
+{
+        sockid_t sockid;
+        msgid_t msgid;
+        ltgbuf_t buf;
+        nid_t nid;
+
+        request_trans(arg, &nid, &sockid, &msgid, &buf, NULL);
+
+        // may run inline, no sche_task_setname here
+        DBUG("drop expired msg, id (%u, %x)\n", msgid.idx, msgid.figerprint);
+
+        ltgbuf_free(&buf);
+        corerpc_reply_error(&sockid, &msgid, ETIMEDOUT);
+        return;
+}
+
+/*
+ * the caller gave up at the deadline, drop the request if it expired in
+ * queue, otherwise the handler task inherits the deadline.
+ */
+static void IO_FUNC __request_deadline(void *arg)
+{
+        rpc_request_t *rpc_request = arg;
+
+        if (unlikely(get_rdtsc() >= rpc_request->deadline)) {
+                __request_expired(arg);
+                return;
+        }
+
+        sche_task_deadline_abs(rpc_request->deadline);
+        rpc_request->handler(arg);
+}
+
+static void IO_FUNC __request_deadline_inline(void *arg)
+{
+        rpc_request_t *rpc_request = arg;
+
+        if (unlikely(get_rdtsc() >= rpc_request->deadline)) {
+                __request_expired(arg);
+                return;
+        }
+
+        rpc_request->handler(arg);
+}
+
 static int IO_FUNC __corerpc_request_handler(corerpc_ctx_t *ctx, const ltg_net_head_t *head,
                                              ltgbuf_t *buf)
 {
-        int ret;
+        int ret, nonblock;
         rpc_request_t *rpc_request;
         const msgid_t *msgid;
         net_prog_t *prog;
@@ -89,11 +135,23 @@ static int IO_FUNC __corerpc_request_handler(corerpc_ctx_t *ctx, const ltg_net_h
                 DERROR("got stale msg, master_magic %x:%x\n",
                        head->master_magic, ltg_global.master_magic);
                 handler = __request_stale;
+                nonblock = 0;
         } else {
                 handler = prog->handler ? prog->handler : __request_nosys;
+                nonblock = prog->flag & NET_PROG_NONBLOCK;
         }
 
-        sche_task_new("corenet", handler, rpc_request, 0);
+        if (head->deadline) {
+                rpc_request->deadline = sche_deadline(sche_self(), head->deadline);
+                rpc_request->handler = handler;
+                handler = nonblock ? __request_deadline_inline : __request_deadline;
+        }
+
+        if (nonblock) {
+                sche_task_inline("corenet", handler, rpc_request);
+        } else {
+                sche_task_new("corenet", handler, rpc_request, sche_group(head->group));
+        }
 
         return 0;
 err_ret:
@@ -162,7 +220,11 @@ static int __corerpc_len(void *buf, uint32_t len)
         LTG_ASSERT(len >= sizeof(ltg_net_head_t));
         head = buf;
 
-        LTG_ASSERT(head->magic == LTG_MSG_MAGIC);
+        if (unlikely(head->magic != LTG_MSG_MAGIC)) {
+                DERROR("bad magic %x, need %x, peer of another head layout?\n",
+                       head->magic, LTG_MSG_MAGIC);
+                return -EPROTO;
+        }
 
         DBUG("len %u %u\n", head->len, head->blocks);
 
@@ -274,6 +336,11 @@ int corerpc_recv(void *_ctx, void *buf, int *_count)
         while (mbuf->len >= sizeof(ltg_net_head_t)) {
                 ltgbuf_get(mbuf, tmp, sizeof(ltg_net_head_t));
                 len = __corerpc_len(tmp, sizeof(ltg_net_head_t));
+                if (unlikely(len < 0)) {
+                        // corenet closes the connection
+                        *_count = count;
+                        return -len;
+                }
 
                 DBUG("msg len %u\n", len);
 
@@ -294,7 +361,8 @@ int corerpc_recv(void *_ctx, void *buf, int *_count)
         return 0;
 }
 
-void corerpc_register(int type, net_request_handler handler, void *context)
+void corerpc_register1(int type, net_request_handler handler, void *context,
+                       int flag)
 {
         net_prog_t *prog;
 
@@ -306,6 +374,12 @@ void corerpc_register(int type, net_request_handler handler, void *context)
         
         prog->handler = handler;
         prog->context = context;
+        prog->flag = flag;
+}
+
+void corerpc_register(int type, net_request_handler handler, void *context)
+{
+        corerpc_register1(type, handler, context, 0);
 }
 
 
@@ -30,37 +30,29 @@ static void __corerpc_post_task(void *arg1, void *arg2, void *arg3, void *arg4)
         sche_task_post(&ctx->task, retval, buf);
 }
 
-static void __corerpc_request_reset(const msgid_t *msgid)
+/*
+ * inherit the deadline of the calling task, the remaining budget is
+ * carried in ltg_net_head_t so the server can drop expired work.
+ */
+static int IO_FUNC __corerpc_deadline(corerpc_op_t *op)
 {
-        rpc_table_t *__rpc_table_private__ = corerpc_self();
-        sche_task_reset();
-        rpc_table_free(__rpc_table_private__, msgid);
-}
-
-STATIC int __corerpc_getslot(void *_ctx, rpc_ctx_t *ctx, corerpc_op_t *op, const char *name)
-{
-        int ret;
-        rpc_table_t *__rpc_table_private__ = corerpc_self_byctx(_ctx);
+        int64_t left;
 
-        ANALYSIS_BEGIN(0);
-
-        ret = rpc_table_getslot(__rpc_table_private__, &op->msgid, name);
-        if (unlikely(ret))
-                GOTO(err_ret, ret);
+        left = sche_task_deadline_left();
+        if (likely(left == -1)) {
+                op->deadline = 0;
+                return 0;
+        }
 
-        ctx->task = sche_task_get();
+        if (unlikely(left == 0))
+                return ETIMEDOUT;
 
-        ret = rpc_table_setslot(__rpc_table_private__, &op->msgid,
-                                __corerpc_post_task, ctx, &op->sockid,
-                                &op->coreid.nid, op->timeout);
-        if (unlikely(ret))
-                UNIMPLEMENTED(__DUMP__);
+        if (op->timeout > 0 && left > (int64_t)op->timeout * 1000 * 1000)
+                left = (int64_t)op->timeout * 1000 * 1000;
 
-        ANALYSIS_QUEUE(0, IO_INFO, NULL);
+        op->deadline = left > UINT32_MAX ? UINT32_MAX : left;
 
         return 0;
-err_ret:
-        return ret;
 }
 
 STATIC int __corerpc_wait__(const char *name, ltgbuf_t *rbuf,
@@ -123,6 +115,8 @@ int corerpc_rdma_request(void *ctx, void *_op)
         if (unlikely(ret))
                 GOTO(err_ret, ret);
 
+        ((ltg_net_head_t *)ltgbuf_head(&buf))->deadline = op->deadline;
+
         ret = corenet_rdma_send(&op->sockid, &buf, NULL, 0, 0, build_post_send_req);
         if (unlikely(ret)) {
                 GOTO(err_free, ret);
@@ -146,6 +140,8 @@ int corerpc_tcp_request(void *ctx, void *_op)
         if (unlikely(ret))
                 GOTO(err_ret, ret);
 
+        ((ltg_net_head_t *)ltgbuf_head(&buf))->deadline = op->deadline;
+
         ret = corenet_tcp_send(ctx, &op->sockid, &buf);
         if (unlikely(ret)) {
                 GOTO(err_free, ret);
@@ -158,23 +154,54 @@ err_ret:
         return ret;
 }
 
-static int __corerpc_send_and_wait(void *core, const char *name, corerpc_op_t *op,
-                                   uint64_t *latency)
+/*
+ * bytes the rpc moves either way, picks the corenet lane. rbuf may not be
+ * initialized yet, the reply size comes from msg_size.
+ */
+static inline int __corerpc_size(const corerpc_op_t *op)
+{
+        int size = op->reqlen;
+
+        if (op->wbuf)
+                size += op->wbuf->len;
+
+        return op->msg_size > size ? op->msg_size : size;
+}
+
+/*
+ * take a rpc_table slot completed by func(arg, retval, buf, latency) and
+ * send the request, used by postwait and the futures.
+ */
+static int IO_FUNC __corerpc_send(void *core, const char *name, corerpc_op_t *op,
+                                  func3_t func, void *arg)
 {
         int ret;
-        rpc_ctx_t rpc_ctx;
+        rpc_table_t *__rpc_table_private__ = corerpc_self_byctx(core);
 
         ANALYSIS_BEGIN(0);
 
-        DBUG("%s\n", name);
+        ret = __corerpc_deadline(op);
+        if (unlikely(ret))
+                GOTO(err_ret, ret);
 
-        ret = __corerpc_getslot(core, &rpc_ctx, op, name);
+        ret = rpc_table_getslot(__rpc_table_private__, &op->msgid, name);
         if (unlikely(ret))
                 GOTO(err_ret, ret);
 
+        ret = rpc_table_setslot(__rpc_table_private__, &op->msgid,
+                                func, arg, &op->sockid,
+                                &op->coreid.nid, op->timeout);
+        if (unlikely(ret))
+                UNIMPLEMENTED(__DUMP__);
+
+        if (op->deadline) {
+                // expired by the private timer, rpc_table_post clears it
+                rpc_table_deadline(__rpc_table_private__, &op->msgid,
+                                   sche_deadline(sche_self(), op->deadline));
+        }
+
         ret = op->sockid.request(core, op);
         if (unlikely(ret)) {
-                sche_task_reset();
                 corenet_maping_close(&op->coreid.nid, &op->sockid);
 		ret = _errno_net(ret);
 		LTG_ASSERT(ret == ENONET || ret == ESHUTDOWN);
@@ -186,6 +213,34 @@ static int __corerpc_send_and_wait(void *core, const char *name, corerpc_op_t *o
 
         SOCKID_DUMP(&op->sockid);
         MSGID_DUMP(&op->msgid);
+
+        ANALYSIS_QUEUE(0, IO_INFO, NULL);
+
+        return 0;
+err_free:
+        rpc_table_free(__rpc_table_private__, &op->msgid);
+err_ret:
+        return ret;
+}
+
+static int __corerpc_send_and_wait(void *core, const char *name, corerpc_op_t *op,
+                                   uint64_t *latency)
+{
+        int ret;
+        rpc_ctx_t rpc_ctx;
+
+        ANALYSIS_BEGIN(0);
+
+        DBUG("%s\n", name);
+
+        rpc_ctx.task = sche_task_get();
+
+        ret = __corerpc_send(core, name, op, __corerpc_post_task, &rpc_ctx);
+        if (unlikely(ret)) {
+                sche_task_reset();
+                GOTO(err_ret, ret);
+        }
+
         ret = __corerpc_wait__(name, op->rbuf, &rpc_ctx);
         if (unlikely(ret)) {
                 GOTO(err_ret, ret);
@@ -196,9 +251,6 @@ static int __corerpc_send_and_wait(void *core, const char *name, corerpc_op_t *o
         ANALYSIS_QUEUE(0, IO_INFO, NULL);
 
         return 0;
-
-err_free:
-        __corerpc_request_reset(&op->msgid);
 err_ret:
         return ret;
 }
@@ -215,7 +267,8 @@ int IO_FUNC __corerpc_postwait(const char *name, corerpc_op_t *op, uint64_t *lat
                 GOTO(err_ret, ret);
         }
         
-        ret = corenet_maping(core, &op->coreid, &op->sockid);
+        ret = corenet_maping(core, &op->coreid, __corerpc_size(op),
+                             &op->sockid);
         if (unlikely(ret))
                 GOTO(err_ret, ret);
 
@@ -379,3 +432,131 @@ int corerpc_postwait_sock(const char *name, const coreid_t *coreid,
 err_ret:
         return ret;
 }
+
+static void __corerpc_future_post(void *arg1, void *arg2, void *arg3, void *arg4)
+{
+        corerpc_future_t *future = arg1;
+        int retval = *(int *)arg2;
+        ltgbuf_t *buf = arg3;
+
+        future->latency = *(uint64_t *)arg4;
+
+        if (buf && buf->len) {
+                LTG_ASSERT(future->op.rbuf);
+                ltgbuf_clone1(future->op.rbuf, buf, 0);
+                ltgbuf_free(buf);
+        }
+
+        sche_future_set(&future->future, retval);
+}
+
+int IO_FUNC corerpc_post(const char *name, corerpc_future_t *future,
+                         const coreid_t *coreid, const void *request, int reqlen,
+                         const ltgbuf_t *wbuf, ltgbuf_t *rbuf, int msg_type,
+                         int msg_size, int group, int timeout)
+{
+        int ret;
+        core_t *core = core_self();
+        corerpc_op_t *op = &future->op;
+
+        sche_future_init(&future->future);
+        future->latency = 0;
+
+        op->coreid = *coreid;
+        op->request = request;
+        op->reqlen = reqlen;
+        op->wbuf = wbuf;
+        op->rbuf = rbuf;
+        op->group = group;
+        op->msg_type = msg_type;
+        op->msg_size = msg_size;
+        op->timeout = timeout;
+
+        // no core rpc table, a blocking stdrpc call would serialize the fan-out
+        if (unlikely(!(ltgconf_global.daemon && corerpc_inited))) {
+                ret = ENOSYS;
+                GOTO(err_set, ret);
+        }
+
+        if (!netable_connected(&op->coreid.nid)) {
+                ret = ENONET;
+                GOTO(err_set, ret);
+        }
+
+        ret = corenet_maping(core, &op->coreid, __corerpc_size(op),
+                             &op->sockid);
+        if (unlikely(ret))
+                GOTO(err_set, ret);
+
+        ret = __corerpc_send(core, name, op, __corerpc_future_post, future);
+        if (unlikely(ret))
+                GOTO(err_set, ret);
+
+        return 0;
+err_set:
+        sche_future_set(&future->future, ret);
+        return ret;
+}
+
+static int __corerpc_future_wait(corerpc_future_t *futures, int count, int k)
+{
+        sche_future_t *array[SCHE_FUTURE_MAX];
+
+        LTG_ASSERT(count <= SCHE_FUTURE_MAX);
+
+        for (int i = 0; i < count; i++) {
+                array[i] = &futures[i].future;
+        }
+
+        return sche_future_wait("corerpc_wait", array, count, k);
+}
+
+int corerpc_wait_all(corerpc_future_t *futures, int count)
+{
+        return __corerpc_future_wait(futures, count, count);
+}
+
+/**
+ * @param idx the first future completed successfully
+ */
+int corerpc_wait_any(corerpc_future_t *futures, int count, int *idx)
+{
+        int ret;
+
+        ret = __corerpc_future_wait(futures, count, 1);
+        if (unlikely(ret))
+                GOTO(err_ret, ret);
+
+        for (int i = 0; i < count; i++) {
+                if (futures[i].future.done && futures[i].future.retval == 0) {
+                        *idx = i;
+                        break;
+                }
+        }
+
+        return 0;
+err_ret:
+        return ret;
+}
+
+int corerpc_wait_quorum(corerpc_future_t *futures, int count, int k)
+{
+        return __corerpc_future_wait(futures, count, k);
+}
+
+/**
+ * drop the slots of futures still pending, a late reply is then stale
+ */
+void corerpc_future_release(corerpc_future_t *futures, int count)
+{
+        rpc_table_t *__rpc_table_private__;
+
+        for (int i = 0; i < count; i++) {
+                if (futures[i].future.done)
+                        continue;
+
+                __rpc_table_private__ = corerpc_self();
+                rpc_table_free(__rpc_table_private__, &futures[i].op.msgid);
+                sche_future_set(&futures[i].future, ECANCELED);
+        }
+}
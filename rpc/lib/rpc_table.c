@@ -11,6 +11,7 @@
 #include "ltg_utils.h"
 #include "ltg_net.h"
 #include "ltg_rpc.h"
+#include "ltg_core.h"
 #include "core/corenet.h"
 
 rpc_table_t *__rpc_table__;
@@ -48,6 +49,7 @@ static void __rpc_table_free(rpc_table_t *rpc_table, slot_t *slot)
         slot->func = NULL;
         slot->arg = NULL;
         slot->timeout = 0;
+        slot->deadline = 0;
         slot->figerprint_prev = slot->msgid.figerprint;
         slot->msgid.figerprint = 0;
 
@@ -84,7 +86,8 @@ static int __rpc_table_unlock(rpc_table_t *rpc_table, slot_t *slot)
                 return ltg_spin_unlock(&slot->lock);
 }
 
-static int __rpc_table_check(rpc_table_t *rpc_table, slot_t *slot, uint32_t now)
+static int __rpc_table_check(rpc_table_t *rpc_table, slot_t *slot, uint32_t now,
+                             uint64_t tsc)
 {
         int ret, retval = ETIMEDOUT;
         sockid_t *closed = NULL, sockid;
@@ -122,7 +125,16 @@ static int __rpc_table_check(rpc_table_t *rpc_table, slot_t *slot, uint32_t now)
                      slot->msgid.figerprint, (int)(now - slot->begin));
         }
 
-        if (slot->timeout && now > slot->timeout) {
+        if (slot->deadline && tsc >= slot->deadline) {
+                DBUG("%s @ %s/%u(%s) deadline, id (%u, %x), used %u\n",
+                     slot->name, _inet_ntoa(slot->sockid.addr), slot->sockid.sd,
+                     conn, slot->msgid.idx, slot->msgid.figerprint,
+                     (int)(now - slot->begin));
+
+                uint64_t latency = -1;
+                slot->func(slot->arg, &retval, NULL, &latency);
+                __rpc_table_free(rpc_table, slot);
+        } else if (slot->timeout && now > slot->timeout) {
                 DWARN("%s @ %s/%u(%s) timeout, id (%u, %x), rpc %u "
                       "used %u timeout %d\n", slot->name,
                       _inet_ntoa(slot->sockid.addr), slot->sockid.sd,
@@ -171,36 +183,56 @@ err_ret:
         return ret;
 }
 
-static void __rpc_table_scan(rpc_table_t *rpc_table)
+/*
+ * check up to step slots from scan_cur, a pass over the table may span
+ * several calls so a core does not stall on a large table.
+ * @return slots looked at
+ */
+static int __rpc_table_scan(rpc_table_t *rpc_table, uint32_t step)
 {
         slot_t *slot;
-        uint32_t i, used = 0, checked = 0;
+        uint32_t i, end;
         time_t now = gettime();
+        uint64_t tsc = get_rdtsc();
         
         ANALYSIS_BEGIN(0);
-                
-        for (i = 0; i < rpc_table->count; i++) {
+
+        end = _min(rpc_table->scan_cur + step, rpc_table->count);
+        for (i = rpc_table->scan_cur; i < end; i++) {
                 slot = rpc_table->slot[i];
 
                 if (!__rpc_table_used(rpc_table, slot)) {
                         continue;
                 }
 
-                used++;
+                rpc_table->scan_used++;
 
-                __rpc_table_check(rpc_table, slot, now);
+                __rpc_table_check(rpc_table, slot, now, tsc);
 
-                checked++;
+                rpc_table->scan_checked++;
         }
 
         ANALYSIS_END(0, IO_WARN, NULL);
 
+        i = end - rpc_table->scan_cur;
+        if (end < rpc_table->count) {
+                rpc_table->scan_cur = end;
+                return i;
+        }
+
+        rpc_table->scan_cur = 0;
         rpc_table->last_scan = gettime();
 
-        if (used && (rpc_table->cycle % 2 == 0)) {
+        if (rpc_table->scan_used && (rpc_table->cycle % 2 == 0)) {
                 rpc_table->cycle++;
-                DINFO("%s used %u/%u\n", rpc_table->name, used, checked);
+                DINFO("%s used %u/%u\n", rpc_table->name, rpc_table->scan_used,
+                      rpc_table->scan_checked);
         }
+
+        rpc_table->scan_used = 0;
+        rpc_table->scan_checked = 0;
+
+        return i;
 }
 
 #if 0
@@ -212,18 +244,43 @@ static void __rpc_table_scan_task(void *args)
 }
 #endif
 
-void rpc_table_scan(rpc_table_t *rpc_table, int interval, int newtask)
+static void __rpc_table_scan_next(void *arg)
+{
+        rpc_table_t *rpc_table = arg;
+
+        __rpc_table_scan(rpc_table, RPC_TABLE_SCAN_STEP);
+        if (rpc_table->scan_cur) {
+                timer_insert("rpc_table_scan", rpc_table, __rpc_table_scan_next, 0);
+        }
+}
+
+/*
+ * a private table with a private timer checks RPC_TABLE_SCAN_STEP slots
+ * per call and goes on from a timer at the next loop, so a pass does not
+ * stall the core. the scan worker thread does a whole pass at once.
+ * @return slots looked at, 0 if nothing was due
+ */
+int rpc_table_scan(rpc_table_t *rpc_table, int interval, int newtask)
 {
-        int tmo;
+        int tmo, count;
         time_t now;
+        uint32_t step;
 
         (void) newtask;
 
+        if (rpc_table->scan_cur) {
+                // the pass goes on from __rpc_table_scan_next
+                return 0;
+        }
+
+        step = (rpc_table->private && timer_private())
+                ? RPC_TABLE_SCAN_STEP : rpc_table->count;
+
         now = gettime();
         if (now < rpc_table->last_scan) {
                 DERROR("update time %u --> %u\n", (int)now, (int)rpc_table->last_scan);
                 rpc_table->last_scan = now;
-                return;
+                return 0;
         }
 
         if (now - rpc_table->last_scan > interval) {
@@ -236,14 +293,22 @@ void rpc_table_scan(rpc_table_t *rpc_table, int interval, int newtask)
                 rpc_table->last_scan = now;
 #if 0
                 if (newtask) {
-                        sche_task_new("rpc_table_scan", __rpc_table_scan_task, rpc_table, -1);
+                        sche_task_new("rpc_table_scan", __rpc_table_scan_task, rpc_table, SCHE_GROUP3);
                 } else {
                         __rpc_table_scan(rpc_table);
                 }
 #else
-                __rpc_table_scan(rpc_table);
+                count = __rpc_table_scan(rpc_table, step);
+                if (rpc_table->scan_cur) {
+                        timer_insert("rpc_table_scan", rpc_table,
+                                     __rpc_table_scan_next, 0);
+                }
+
+                return count;
 #endif
         }
+
+        return 0;
 }
 
 static void  *__rpc_table_scan_worker(void *arg)
@@ -334,6 +399,7 @@ int rpc_table_getslot(rpc_table_t *rpc_table, msgid_t *msgid, const char *name)
 
         *msgid = slot->msgid;
         strcpy(slot->name, name);
+        TRACE(TRACE_RPC_GETSLOT, msgid->idx, msgid->figerprint, name);
 
         return 0;
 err_ret:
@@ -404,6 +470,106 @@ err_ret:
         return ret;
 }
 
+static void __rpc_table_deadline_arm(rpc_table_t *rpc_table, uint64_t deadline,
+                                     uint64_t now);
+
+/*
+ * expire the slots whose deadline passed, the rest re-arm the timer at the
+ * earliest one. a timer superseded by an earlier one finds deadline_timer
+ * moved and does nothing.
+ */
+static void __rpc_table_deadline_expire(void *arg)
+{
+        int ret, retval;
+        uint32_t i;
+        uint64_t now, next = 0, tick;
+        slot_t *slot;
+        rpc_table_t *rpc_table = arg;
+
+        now = get_rdtsc();
+        tick = RPC_TABLE_DEADLINE_TICK * (sche_self()->hz / (1000 * 1000));
+        if (rpc_table->deadline_timer == 0 || rpc_table->deadline_timer > now + tick)
+                return;
+
+        rpc_table->deadline_timer = 0;
+
+        for (i = 0; i < rpc_table->count; i++) {
+                slot = rpc_table->slot[i];
+                if (!slot->deadline || !__rpc_table_used(rpc_table, slot))
+                        continue;
+
+                if (slot->deadline > now) {
+                        if (next == 0 || slot->deadline < next)
+                                next = slot->deadline;
+
+                        continue;
+                }
+
+                ret = __rpc_table_trylock(rpc_table, slot);
+                if (unlikely(ret))
+                        continue;
+
+                DBUG("%s @ %s/%u deadline, id (%u, %x)\n", slot->name,
+                     _inet_ntoa(slot->sockid.addr), slot->sockid.sd,
+                     slot->msgid.idx, slot->msgid.figerprint);
+
+                retval = ETIMEDOUT;
+                uint64_t latency = -1;
+                slot->func(slot->arg, &retval, NULL, &latency);
+                __rpc_table_free(rpc_table, slot);
+
+                __rpc_table_unlock(rpc_table, slot);
+        }
+
+        if (next) {
+                __rpc_table_deadline_arm(rpc_table, next, now);
+        }
+}
+
+/*
+ * one timer per table at the earliest deadline, at most one pass per
+ * RPC_TABLE_DEADLINE_TICK.
+ */
+static void __rpc_table_deadline_arm(rpc_table_t *rpc_table, uint64_t deadline,
+                                     uint64_t now)
+{
+        uint64_t hz = sche_self()->hz / (1000 * 1000);
+        uint64_t tick = RPC_TABLE_DEADLINE_TICK * hz;
+
+        if (deadline < now + tick)
+                deadline = now + tick;
+
+        // the armed timer fires first and re-arms for this one
+        if (rpc_table->deadline_timer && rpc_table->deadline_timer < deadline + tick)
+                return;
+
+        rpc_table->deadline_timer = deadline;
+        timer_insert("rpc_deadline", rpc_table, __rpc_table_deadline_expire,
+                     (deadline - now) / hz);
+}
+
+/*
+ * expire the slot at rdtsc deadline, the slot must be set already.
+ * private tables with a private timer only, otherwise the slot waits for
+ * its timeout.
+ */
+void rpc_table_deadline(rpc_table_t *rpc_table, const msgid_t *msgid, uint64_t deadline)
+{
+        slot_t *slot;
+
+        if (unlikely(!rpc_table->private || !timer_private()))
+                return;
+
+        slot = __rpc_table_lock_slot(rpc_table, msgid);
+        if (unlikely(slot == NULL))
+                return;
+
+        slot->deadline = deadline;
+        __rpc_table_deadline_arm(rpc_table, deadline, get_rdtsc());
+
+        __rpc_table_unlock(rpc_table, slot);
+}
+
 int IO_FUNC rpc_table_post(rpc_table_t *rpc_table, const msgid_t *msgid, int retval,
                    ltgbuf_t *buf, uint64_t latency)
 {
@@ -416,6 +582,7 @@ int IO_FUNC rpc_table_post(rpc_table_t *rpc_table, const msgid_t *msgid, int ret
                 GOTO(err_ret, ret);
         }
 
+        TRACE(TRACE_RPC_POST, msgid->idx, retval, slot->name);
         slot->func(slot->arg, &retval, buf, &latency);
 
         __rpc_table_free(rpc_table, slot);
@@ -567,6 +734,9 @@ static int __rpc_table_create(const char *name, int count, int tabid,
         rpc_table->count = count;
         rpc_table->tabid = tabid;
         rpc_table->last_scan = 0;
+        rpc_table->scan_cur = 0;
+        rpc_table->scan_used = 0;
+        rpc_table->scan_checked = 0;
         rpc_table->private = private;
         *_rpc_table = rpc_table;
 
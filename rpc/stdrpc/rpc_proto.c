@@ -47,7 +47,12 @@ int rpc_pack_len(void *buf, uint32_t len, int *msg_len, int *io_len)
 
         if (len > sizeof(uint32_t)) {
                 head = buf;
-                LTG_ASSERT(head->magic == LTG_MSG_MAGIC);
+                if (unlikely(head->magic != LTG_MSG_MAGIC)) {
+                        DERROR("bad magic %x, need %x\n", head->magic,
+                               LTG_MSG_MAGIC);
+                        ret = EPROTO;
+                        GOTO(err_ret, ret);
+                }
         }
 
         if (len < sizeof(ltg_net_head_t)) {
@@ -132,7 +137,7 @@ STATIC int __rpc_request_handler(const nid_t *nid, const sockid_t *sockid,
         handler = prog->handler ? prog->handler : __request_nosys;
 
         if (head->coreid == (uint32_t)-1) {
-                sche_task_new("rpc", handler, rpc_request, 0);
+                sche_task_new("rpc", handler, rpc_request, sche_group(head->group));
         } else {
                 ret = core_request(head->coreid, -1, "rpc_request",
                                    __core_request, handler, rpc_request, head->group);
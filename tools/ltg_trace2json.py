@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+#
+# convert the per thread trace dumps (/dev/shm/<system>/trace/*.bin, see
+# include/utils/trace.h) to chrome trace json, open it in chrome://tracing
+# or ui.perfetto.dev
+#
+# usage: ltg_trace2json.py <dump dir or files...> [-o out.json]
+
+import argparse
+import glob
+import json
+import os
+import struct
+import sys
+
+TRACE_MAGIC = 0x4c544754
+TRACE_VERSION = 1
+
+FILE_HEAD = struct.Struct("<IIQII32s")
+EVENT = struct.Struct("<QHHIQ24s")
+
+TASK_CREATE = 1
+TASK_RESUME = 2
+TASK_YIELD = 3
+TASK_EXIT = 4
+
+TYPE_NAME = {
+    1: "task_create",
+    2: "task_resume",
+    3: "task_yield",
+    4: "task_exit",
+    5: "ring_enq",
+    6: "ring_deq",
+    7: "net_send",
+    8: "net_commit",
+    9: "net_recv",
+    10: "rpc_getslot",
+    11: "rpc_post",
+}
+
+TYPE_ARGS = {
+    5: ("core", None),
+    6: (None, "count"),
+    7: ("sd", "bytes"),
+    8: ("sd", "bytes"),
+    9: ("sd", "bytes"),
+    10: ("msgid", "figerprint"),
+    11: ("msgid", "retval"),
+}
+
+
+def cstr(raw):
+    return raw.split(b"\0", 1)[0].decode("utf-8", "replace")
+
+
+def load(path):
+    with open(path, "rb") as f:
+        data = f.read()
+
+    magic, version, hz, thread, count, name = FILE_HEAD.unpack_from(data, 0)
+    if magic != TRACE_MAGIC or version != TRACE_VERSION:
+        raise ValueError("%s: not a trace dump" % path)
+
+    events = []
+    off = FILE_HEAD.size
+    for _ in range(count):
+        if off + EVENT.size > len(data):
+            break
+        events.append(EVENT.unpack_from(data, off))
+        off += EVENT.size
+
+    return {"hz": hz, "thread": thread, "name": cstr(name), "events": events}
+
+
+def convert(dumps):
+    out = []
+    base = min((d["events"][0][0] for d in dumps if d["events"]), default=0)
+
+    for d in dumps:
+        tid = d["thread"]
+        tick = d["hz"] / 1e6 if d["hz"] else 1.0
+        out.append({"ph": "M", "name": "thread_name", "pid": 0, "tid": tid,
+                    "args": {"name": "%s[%u]" % (d["name"], tid)}})
+
+        running = False
+        for tsc, type, _, id, arg, name in d["events"]:
+            ts = (tsc - base) / tick
+            name = cstr(name)
+
+            if type == TASK_RESUME:
+                out.append({"ph": "B", "name": name, "cat": "task", "pid": 0,
+                            "tid": tid, "ts": ts,
+                            "args": {"task": id, "group": arg}})
+                running = True
+            elif type in (TASK_YIELD, TASK_EXIT):
+                # the dump may start in the middle of a run
+                if not running:
+                    continue
+                ev = {"ph": "E", "pid": 0, "tid": tid, "ts": ts}
+                if type == TASK_YIELD:
+                    ev["args"] = {"wait": name}
+                out.append(ev)
+                running = False
+            else:
+                args = {}
+                key_id, key_arg = TYPE_ARGS.get(type, ("id", "arg"))
+                if key_id:
+                    args[key_id] = id
+                if key_arg:
+                    args[key_arg] = arg
+                if name:
+                    args["name"] = name
+                if type == TASK_CREATE:
+                    args = {"task": id, "group": arg}
+                out.append({"ph": "i", "s": "t",
+                            "name": TYPE_NAME.get(type, str(type)),
+                            "cat": TYPE_NAME.get(type, "unknown").split("_")[0],
+                            "pid": 0, "tid": tid, "ts": ts, "args": args})
+
+    return {"traceEvents": out, "displayTimeUnit": "ns"}
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("input", nargs="+", help="dump dir or .bin files")
+    parser.add_argument("-o", "--output", default="-")
+    args = parser.parse_args()
+
+    paths = []
+    for p in args.input:
+        if os.path.isdir(p):
+            paths.extend(sorted(glob.glob(os.path.join(p, "*.bin"))))
+        else:
+            paths.append(p)
+
+    dumps = [load(p) for p in paths]
+    trace = convert(dumps)
+
+    if args.output == "-":
+        json.dump(trace, sys.stdout)
+    else:
+        with open(args.output, "w") as f:
+            json.dump(trace, f)
+
+
+if __name__ == "__main__":
+    main()
@@ -159,6 +159,13 @@ err_ret:
         return ret;
 }       
 
+inline static int __dmsg_trace(const char *buf, uint32_t extra)
+{
+        (void) extra;
+
+        return trace_ctl(atoi(buf));
+}
+
 int dmsg_init_misc(const char *name, const char *value,
                    int (*callback)(const char *buf, uint32_t flag),
                    uint32_t flag)
@@ -191,6 +198,10 @@ int dmsg_init()
         if (unlikely(ret))
                 GOTO(err_ret, ret);
 
+        ret = __dmsg_init_sub(DTRACE_PATH, "0", __dmsg_trace, 0);
+        if (unlikely(ret))
+                GOTO(err_ret, ret);
+
         ret = __dmsg_init_sub(DBUG_UTILS_PATH, "0", __dmsg_sub, S_LTG_UTILS);
         if (unlikely(ret))
                 GOTO(err_ret, ret);
@@ -47,7 +47,7 @@ int plock_init(plock_t *rwlock, const char *name)
 {
         INIT_LIST_HEAD(&rwlock->queue);
 
-        static_assert(TASK_MAX < INT16_MAX, "static");
+        static_assert(TASK_MAX < INT32_MAX, "static");
         
         (void) name;
         rwlock->writer = -1;
@@ -107,7 +107,7 @@ STATIC int IO_FUNC __plock_trylock(plock_t *rwlock, char type, char force, task_
 
         if (type == 'r') {
                 if (rwlock->writer == -1 && (list_empty(&rwlock->queue) || force)) {
-                        LTG_ASSERT(rwlock->readers - 1 < UINT16_MAX);
+                        LTG_ASSERT(rwlock->readers < UINT32_MAX);
                         rwlock->readers++;
 #ifdef PLOCK_DMSG
                         DINFO("read lock reader %u\n", rwlock->readers);
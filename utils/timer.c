@@ -387,6 +387,41 @@ static void __timer_expire_task(void *arg)
 }
 #endif
 
+/**
+ * @return 1 if timer_insert callbacks run on the calling core
+ */
+int timer_private()
+{
+        return core_tls_get(NULL, VARIABLE_TIMER) != NULL;
+}
+
+/**
+ * private timer only
+ *
+ * @return usec to the first entry, -1 if empty
+ */
+int64_t timer_idle(void *ctx)
+{
+        int ret;
+        void *first;
+        ltimer_t *timer;
+        __time_t now;
+
+        timer = core_tls_get(ctx, VARIABLE_TIMER);
+        if (unlikely(timer == NULL))
+                return -1;
+
+        ret = skiplist_get1st(timer->group.list, &first);
+        if (ret)
+                return -1;
+
+        now = __timer_gettime();
+        if (((entry_t *)first)->time <= now)
+                return 0;
+
+        return ((entry_t *)first)->time - now;
+}
+
 void IO_FUNC timer_expire(void *ctx)
 {
         ltimer_t *timer;
@@ -0,0 +1,226 @@
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define DBG_SUBSYS S_LTG_UTILS
+
+#include "ltg_utils.h"
+#include "ltg_core.h"
+
+typedef struct {
+        uint64_t head;          // next event, published by the owner
+        int idx;
+        char name[32];
+        trace_event_t *array;
+} trace_ring_t;
+
+int ltg_trace_on = 0;
+
+static __thread trace_ring_t *__trace_ring__ = NULL;
+static trace_ring_t *__trace_array__[TRACE_THREAD_MAX];
+static int __trace_count__ = 0;
+static uint64_t __trace_hz__ = 0;
+
+static trace_ring_t *__trace_ring_create()
+{
+        int ret, idx;
+        trace_ring_t *ring;
+        sche_t *sche = sche_self();
+
+        // rings are never freed, short lived threads would use up the slots
+        if (sche == NULL)
+                return NULL;
+
+        idx = __atomic_fetch_add(&__trace_count__, 1, __ATOMIC_RELAXED);
+        if (unlikely(idx >= TRACE_THREAD_MAX)) {
+                // not traced, keep the slot count saturated
+                __atomic_store_n(&__trace_count__, TRACE_THREAD_MAX, __ATOMIC_RELAXED);
+                return NULL;
+        }
+
+        ret = ltg_malloc((void **)&ring, sizeof(*ring));
+        if (unlikely(ret))
+                return NULL;
+
+        ret = ltg_malloc((void **)&ring->array,
+                         sizeof(trace_event_t) * TRACE_RING_SIZE);
+        if (unlikely(ret)) {
+                ltg_free((void **)&ring);
+                return NULL;
+        }
+
+        ring->head = 0;
+        ring->idx = idx;
+        snprintf(ring->name, sizeof(ring->name), "%s", sche->name);
+
+        __trace_ring__ = ring;
+        __atomic_store_n(&__trace_array__[idx], ring, __ATOMIC_RELEASE);
+
+        DINFO("trace %s[%u] ring created\n", ring->name, idx);
+
+        return ring;
+}
+
+void IO_FUNC trace_event(int type, uint32_t id, uint64_t arg, const char *name)
+{
+        uint64_t head;
+        trace_event_t *ev;
+        trace_ring_t *ring = __trace_ring__;
+
+        if (unlikely(ring == NULL)) {
+                ring = __trace_ring_create();
+                if (unlikely(ring == NULL))
+                        return;
+        }
+
+        head = ring->head;
+        ev = &ring->array[head & (TRACE_RING_SIZE - 1)];
+        ev->tsc = get_rdtsc();
+        ev->type = type;
+        ev->thread = ring->idx;
+        ev->id = id;
+        ev->arg = arg;
+        if (name) {
+                strncpy(ev->name, name, TRACE_NAME_LEN - 1);
+                ev->name[TRACE_NAME_LEN - 1] = '\0';
+        } else {
+                ev->name[0] = '\0';
+        }
+
+        __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * copy the ring while the owner keeps writing, events overwritten during
+ * the copy are dropped by re-reading head afterwards.
+ */
+static int __trace_dump_ring(const char *dir, trace_ring_t *ring,
+                             trace_event_t *array)
+{
+        int ret, fd;
+        char path[MAX_PATH_LEN];
+        uint64_t head, tail, valid, i;
+        trace_file_t file;
+
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        tail = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+
+        for (i = tail; i < head; i++) {
+                array[i - tail] = ring->array[i & (TRACE_RING_SIZE - 1)];
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        valid = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        valid = valid >= TRACE_RING_SIZE ? valid - TRACE_RING_SIZE + 1 : 0;
+        valid = valid > tail ? valid : tail;
+        if (valid > head)
+                valid = head;
+
+        snprintf(path, MAX_PATH_LEN, "%s/%u.bin", dir, ring->idx);
+        fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+        if (fd < 0) {
+                ret = errno;
+                GOTO(err_ret, ret);
+        }
+
+        memset(&file, 0x0, sizeof(file));
+        file.magic = TRACE_MAGIC;
+        file.version = TRACE_VERSION;
+        file.hz = __trace_hz__;
+        file.thread = ring->idx;
+        file.count = head - valid;
+        strcpy(file.name, ring->name);
+
+        ret = _write(fd, &file, sizeof(file));
+        if (ret < 0) {
+                ret = -ret;
+                GOTO(err_fd, ret);
+        }
+
+        ret = _write(fd, &array[valid - tail], sizeof(trace_event_t) * file.count);
+        if (ret < 0) {
+                ret = -ret;
+                GOTO(err_fd, ret);
+        }
+
+        close(fd);
+
+        DINFO("trace %s[%u] dump %u events to %s\n", ring->name, ring->idx,
+              file.count, path);
+
+        return 0;
+err_fd:
+        close(fd);
+err_ret:
+        return ret;
+}
+
+int trace_dump(const char *dir)
+{
+        int ret, i, count;
+        trace_ring_t *ring;
+        trace_event_t *array;
+
+        ret = path_validate(dir, LLIB_ISDIR, LLIB_DIRCREATE);
+        if (unlikely(ret))
+                GOTO(err_ret, ret);
+
+        if (__trace_hz__ == 0) {
+                __trace_hz__ = cpu_freq_init();
+        }
+
+        ret = ltg_malloc((void **)&array, sizeof(trace_event_t) * TRACE_RING_SIZE);
+        if (unlikely(ret))
+                GOTO(err_ret, ret);
+
+        count = __atomic_load_n(&__trace_count__, __ATOMIC_RELAXED);
+        for (i = 0; i < count && i < TRACE_THREAD_MAX; i++) {
+                ring = __atomic_load_n(&__trace_array__[i], __ATOMIC_ACQUIRE);
+                if (ring == NULL)
+                        continue;
+
+                ret = __trace_dump_ring(dir, ring, array);
+                if (unlikely(ret))
+                        GOTO(err_free, ret);
+        }
+
+        ltg_free((void **)&array);
+
+        return 0;
+err_free:
+        ltg_free((void **)&array);
+err_ret:
+        return ret;
+}
+
+/**
+ * @param cmd 0 stop, 1 start, 2 dump the rings
+ */
+int trace_ctl(int cmd)
+{
+        int ret;
+        char dir[MAX_PATH_LEN];
+
+        switch (cmd) {
+        case 0:
+        case 1:
+                DINFO("trace %s\n", cmd ? "on" : "off");
+                __atomic_store_n(&ltg_trace_on, cmd, __ATOMIC_RELAXED);
+                break;
+        case 2:
+                snprintf(dir, MAX_PATH_LEN, "/dev/shm/%s/trace",
+                         ltgconf_global.system_name);
+                ret = trace_dump(dir);
+                if (unlikely(ret))
+                        GOTO(err_ret, ret);
+                break;
+        default:
+                ret = EINVAL;
+                GOTO(err_ret, ret);
+        }
+
+        return 0;
+err_ret:
+        return ret;
+}